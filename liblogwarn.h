@@ -0,0 +1,158 @@
+/*
+ * Logwarn - Utility for finding interesting messages in log files
+ *
+ * Copyright (C) 2010-2011 Archie L. Cobbs. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Logwarn library API.
+ *
+ * A pattern set holds an ordered list of positive and negative patterns and `-T' repeat groups.
+ * A scanner scans log files, including any rotated predecessor, against a pattern set using a
+ * scan state from logwarn_state_create(), which it updates in place. Matching lines are passed to an
+ * output callback. Functions that can fail return -1 (or NULL) and leave a message describing
+ * the error in the handle; they never exit the process. Separate handles may be used concurrently.
+ *
+ * A scanner may also evaluate additional rule sets, each with its own pattern set, limits, and
+ * output callback, during the same pass over the log. Rule set N (starting at one) keeps its
+ * state in logwarn_state_set(state, N), which must have been added using logwarn_state_add_set()
+ * in the same order. The pattern set given to logwarn_scanner_create() is rule set zero and may be NULL.
+ *
+ * Each scan also adds to cumulative counters kept in the scan state (and saved with it), which
+ * logwarn_write_metrics() can export for Prometheus.
+ */
+
+#ifndef LIBLOGWARN_H
+#define LIBLOGWARN_H
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque handles
+struct logwarn_patterns;
+struct logwarn_scanner;
+struct logwarn_state;
+
+// Pattern flags
+#define LOGWARN_ICASE               0x01    // match case-insensitively
+
+// I/O flags
+#define LOGWARN_NOCACHE             0x01    // avoid polluting the page cache
+#define LOGWARN_DIRECT              0x02    // use direct I/O
+
+// Line types passed to the output callback; with whole_messages, a "line" may be several lines separated by newlines
+#define LOGWARN_LINE_MATCH          1       // first line of a matching log message
+#define LOGWARN_LINE_CONTINUATION   2       // continuation line of a matching log message
+#define LOGWARN_LINE_CONTEXT        3       // context line
+#define LOGWARN_LINE_SEPARATOR      4       // separates non-contiguous lines of context (line is NULL)
+#define LOGWARN_LINE_FLUSH          5       // good time to flush buffered output when streaming (line is NULL)
+
+// Scan result flags
+#define LOGWARN_MATCHED             0x01    // at least one matching log message was found
+#define LOGWARN_PARTIAL             0x02    // scan stopped early due to a byte or time limit
+
+// Output callback
+typedef void logwarn_output_t(void *arg, int type, unsigned long lnum, const char *line);
+
+// Scanner options; initialize using logwarn_options_init()
+struct logwarn_options {
+    const char          *multiline_pattern;     // first line pattern, or NULL for single line messages
+    const char          *rotated_pattern;       // rotated file suffix pattern
+    int                 pattern_flags;          // LOGWARN_* pattern flags for multiline_pattern
+    int                 io_flags;               // LOGWARN_* I/O flags
+    int                 match_last_rotated;     // choose the last matching rotated file, not the first
+    unsigned int        max_errors_processed;   // maximum number of messages to process
+    unsigned int        max_errors_output;      // maximum number of messages to output
+    unsigned int        max_lines_output;       // maximum number of lines to output per message
+    unsigned long long  max_bytes;              // maximum number of bytes to scan, or zero for no limit
+    unsigned int        max_seconds;            // maximum scan duration, or zero for no limit
+    unsigned int        before_context;         // lines of leading context
+    unsigned int        after_context;          // lines of trailing context
+    const char          *time_format;           // strptime(3) format of log message timestamps, or NULL
+    time_t              since;                  // skip log messages older than this, or zero for no limit
+    time_t              until;                  // stop at log messages this new or newer, or zero for no limit
+    unsigned int        cache_size;             // match verdict cache entries per rule set, or zero for none
+    unsigned int        cache_skip;             // leading characters of each line the cache ignores
+    int                 whole_messages;         // with multiline_pattern, match patterns against whole log messages
+    int                 stream;                 // read standard input without blocking, flushing output when it's idle
+    unsigned int        idle_msecs;             // how long input must be idle; if zero, also flush after each message
+    logwarn_output_t    *output;                // output callback, or NULL for none
+    void                *output_arg;            // output callback argument
+};
+
+// Options for additional rule sets; initialize using logwarn_set_options_init()
+struct logwarn_set_options {
+    unsigned int        max_errors_processed;   // maximum number of messages to process
+    unsigned int        max_errors_output;      // maximum number of messages to output
+    logwarn_output_t    *output;                // output callback, or NULL for none
+    void                *output_arg;            // output callback argument
+};
+
+// Pattern sets
+extern struct logwarn_patterns *logwarn_patterns_create(int default_match);
+extern int  logwarn_patterns_add(struct logwarn_patterns *set, const char *pattern, int flags);
+extern int  logwarn_patterns_add_repeat(struct logwarn_patterns *set, unsigned int num, unsigned int secs);
+extern int  logwarn_patterns_compile(struct logwarn_patterns *set);
+extern const char *logwarn_patterns_error(const struct logwarn_patterns *set);
+extern unsigned int logwarn_patterns_hash(const struct logwarn_patterns *set, unsigned int hash);
+extern void logwarn_patterns_free(struct logwarn_patterns *set);
+
+// Scanners
+extern void logwarn_options_init(struct logwarn_options *options);
+extern void logwarn_set_options_init(struct logwarn_set_options *options);
+extern struct logwarn_scanner *logwarn_scanner_create(struct logwarn_patterns *set,
+    const struct logwarn_options *options, char *errbuf, size_t errlen);
+extern int  logwarn_scanner_add_set(struct logwarn_scanner *scanner, struct logwarn_patterns *set,
+    const struct logwarn_set_options *options);
+extern int  logwarn_scan(struct logwarn_scanner *scanner, const char *logfile, struct logwarn_state *state);
+extern int  logwarn_scanner_matched(const struct logwarn_scanner *scanner, unsigned int index);
+extern const char *logwarn_scanner_error(const struct logwarn_scanner *scanner);
+extern void logwarn_scanner_free(struct logwarn_scanner *scanner);
+
+// Timestamps
+extern int  logwarn_parse_time(const char *format, const char *string, time_t now, time_t *tp);
+
+// Scan state
+extern struct logwarn_state *logwarn_state_create(const struct logwarn_patterns *set);
+extern int  logwarn_state_add_set(struct logwarn_state *state, const char *name, const struct logwarn_patterns *set);
+extern struct logwarn_state *logwarn_state_set(struct logwarn_state *state, unsigned int index);
+extern void logwarn_state_position(const struct logwarn_state *state, unsigned long *linep, off_t *posp);
+extern unsigned int logwarn_state_rules_hash(const struct logwarn_state *state);
+extern void logwarn_state_set_rules_hash(struct logwarn_state *state, unsigned int hash);
+extern void logwarn_state_free(struct logwarn_state *state);
+extern void logwarn_reset_state(struct logwarn_state *state);
+extern void logwarn_rewind_state(struct logwarn_state *state);
+extern int  logwarn_load_state(const char *state_file, struct logwarn_state *state);
+extern int  logwarn_save_state(const char *state_file, const char *logfile, const struct logwarn_state *state);
+extern void logwarn_dump_state(FILE *fp, const char *logfile, const struct logwarn_state *state);
+extern int  logwarn_init_state_from_logfile(const char *logfile, struct logwarn_state *state);
+extern int  logwarn_state_is_current(const struct logwarn_state *state, ino_t inode, off_t size);
+extern void logwarn_state_file_name(const char *state_dir, const char *logfile, char *buf, size_t max);
+
+// Metrics
+extern int  logwarn_write_metrics(const struct logwarn_scanner *scanner, const char *metrics_file,
+    const char *logfile, const struct logwarn_state *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LIBLOGWARN_H */
@@ -17,9 +17,51 @@
  * limitations under the License.
  */
 
+#include <sys/types.h>
+
+#include <regex.h>
+#include <time.h>
+
+#include "liblogwarn.h"
+
 // Maximum line length
 #define MAX_LINE_LENGTH     100000
 
+// Size of error message buffers
+#define ERROR_BUFFER_SIZE   1024
+
+// Default rotated file suffix pattern
+#ifndef DEFAULT_ROTPAT
+#define DEFAULT_ROTPAT      "^(-[[:digit:]]{8}|\\.[01])(\\.(gz|xz|bz2))?$"
+#endif
+
+// Buffered line reader
+struct reader {
+    int             fd;             // file descriptor
+    const char      *name;          // file name for error messages
+    char            *buf;           // read buffer
+    size_t          size;           // buffer size
+    size_t          start;          // offset of next unread byte
+    size_t          end;            // offset of end of buffered data
+    size_t          discard;        // bytes to skip after the next read (direct I/O)
+    off_t           base;           // offset of the start of the buffer
+    off_t           keep;           // offset of the oldest data to retain, or -1 for none
+    off_t           readoff;        // file offset of the next read
+    off_t           consumed;       // file offset of the next unconsumed byte
+    off_t           dropped;        // file offset up to which pages have been dropped from the cache
+    int             flags;          // READER_* flags
+    int             error;          // errno value from a failed read, or zero
+    int             idle_msecs;     // in streaming mode, how long to wait for input before it's idle, else -1
+    unsigned long   reads;          // number of blocks read
+    unsigned char   eof;            // end of file reached
+    unsigned char   idle;           // no input arrived within idle_msecs
+    unsigned char   waiting;        // idle was already reported, so wait indefinitely
+};
+
+// Reader flags
+#define READER_NOCACHE      LOGWARN_NOCACHE
+#define READER_DIRECT       LOGWARN_DIRECT
+
 // Pattern repeat state
 struct repeat {
     unsigned int    hash;           // xor of hashes of pattern string(s)
@@ -28,14 +70,153 @@ struct repeat {
     unsigned long   *occurrences;   // timestamps of up to `num' occurrences, most recent first
 };
 
+// Cumulative counters for one pattern
+struct pattern_stats {
+    unsigned int        hash;           // hash of pattern string
+    unsigned long long  matches;        // log messages decided by this pattern
+    unsigned long long  suppressed;     // matches suppressed by `-T'
+    unsigned long long  attempts;       // times evaluated, if its position is adaptive
+    unsigned long long  nsecs;          // estimated total evaluation time in nanoseconds, likewise
+};
+
+// Cumulative counters, which survive across scans
+struct scan_stats {
+    unsigned long long  messages;       // log messages scanned
+    unsigned long long  matches;        // matching log messages
+    unsigned long long  suppressed;     // matching log messages suppressed by `-T'
+    unsigned long long  lines;          // lines scanned
+    unsigned long long  bytes;          // bytes scanned
+    unsigned long long  rotations;      // log file rotations handled
+    unsigned long long  scan_msecs;     // total scan duration in milliseconds
+    unsigned long long  cache_hits;     // log messages whose verdict was found in the cache
+    unsigned long long  cache_misses;   // log messages whose verdict was not found in the cache
+    unsigned int        num_patterns;   // number of patterns
+    struct pattern_stats *patterns;     // per-pattern counters, in pattern set order
+};
+
 // Log scan state
-struct scan_state {
+struct logwarn_state {
     ino_t           inode;          // file inode number
     unsigned long   line;           // # lines read + 1
     long            pos;            // seek position in file
     unsigned char   matching;       // within matching entry
+    unsigned long   after;          // after context lines still to be output
     unsigned int    num_repeats;    // number of repeats
     struct repeat   *repeats;       // repeat state
+    char            *name;          // rule set name (additional rule sets only)
+    unsigned int    num_sets;       // number of additional rule sets
+    struct logwarn_state *sets;     // state of additional rule sets
+    struct scan_stats stats;        // cumulative counters
+    unsigned int    rules_hash;     // hash of rules known to compile, or zero (not for additional rule sets)
+    off_t           held_pos;       // file offset of a log message left unfinished at end of file (likewise)
+    off_t           held_end;       // file size at the time, or zero if none
+};
+
+// Regular expression pattern
+struct repat {
+    char            *string;        // pattern string
+    regex_t         regex;          // compiled pattern
+    int             eflags;         // regcomp() flags
+    unsigned char   negate;         // negative pattern
+    unsigned char   compiled;       // regex is valid
+    int             repeat;         // index of repeat group, or -1 for none
+    unsigned int    hash;           // hash of pattern string, including any `!'
+};
+
+// Pattern set
+struct logwarn_patterns {
+    struct repat    *patterns;      // patterns in order
+    unsigned int    num_patterns;   // number of patterns
+    struct repeat   *repeats;       // repeat groups (without occurrences)
+    unsigned int    num_repeats;    // number of repeat groups
+    int             default_match;  // result when no pattern matches
+    unsigned char   compiled;       // all patterns have been compiled
+    char            error[ERROR_BUFFER_SIZE];
+};
+
+// Whole log messages longer than this are matched using only their first part
+#define MAX_MESSAGE_SIZE    (1024 * 1024)
+#define MAX_MESSAGE_LINES   10000
+
+// Line of a log message being assembled
+struct message_line {
+    size_t          offset;         // buffer offset of the line from the start of the message
+    size_t          len;            // bytes consumed by the line
+};
+
+// Maximum length of a cached timestamp
+#define MAX_STAMP_LENGTH    64
+
+// Match verdict cache entry
+struct verdict {
+    unsigned int    hash;           // hash of line
+    int             index;          // index of first matching pattern, or -1 for none
+    size_t          len;            // length of line
+    size_t          size;           // size of line buffer
+    char            *line;          // copy of line (less any skipped prefix), or NULL if empty
+};
+
+// Lines longer than this are not cached
+#define MAX_VERDICT_LENGTH  1024
+
+// Leading context line
+struct context_line {
+    off_t           offset;         // reader offset of the line
+    unsigned long   line;           // line number
+};
+
+// Rule set being evaluated by a scanner
+struct scan_set {
+    struct logwarn_patterns *patterns;          // pattern set, or NULL if none
+    struct logwarn_set_options options;         // options
+    struct logwarn_state    *state;             // scan state
+    struct context_line     *before_lines;      // leading context ring
+    struct verdict          *cache;             // match verdict cache, or NULL if none
+    unsigned int            cache_mask;         // number of cache entries minus one
+    unsigned int            *order;             // pattern evaluation order, or NULL if declared order
+    unsigned int            num_order;          // length of order
+    unsigned int            since_reorder;      // pattern evaluations since order was last updated
+    unsigned int            before_start;       // index of oldest leading context line
+    unsigned int            before_count;       // number of leading context lines
+    unsigned int            error_count;        // number of matching messages
+    unsigned int            line_count;         // number of lines in current matching message
+    unsigned char           active;             // participating in the current file
+    unsigned char           stopped;            // reached max_errors_processed
+    unsigned char           any_matches;        // found a matching message
+    unsigned char           any_output;         // output at least one line
+    unsigned char           context_gap;        // lines were skipped since last output
+    unsigned char           unflushed;          // output since the last LOGWARN_LINE_FLUSH
+};
+
+// Scanner
+struct logwarn_scanner {
+    struct logwarn_options  options;            // options
+    struct repat            log_pattern;        // first line pattern, if any
+    struct repat            rot_pattern;        // rotated file suffix pattern
+    struct scan_set         *sets;              // rule sets; the first is from logwarn_scanner_create()
+    unsigned int            num_sets;           // number of rule sets
+    int                     features;           // SCAN_* features in use
+    unsigned int            num_running;        // number of active rule sets not yet stopped
+    struct timespec         start_time;         // time scan started
+    unsigned long long      bytes_scanned;      // bytes scanned so far
+    unsigned char           out_of_time;        // time limit has been reached
+    unsigned char           budget_exhausted;   // stopped due to time or byte limit
+    time_t                  now;                // time scan started, for timestamps without a year
+    off_t                   until_offset;       // no message before this file offset reaches options.until
+    unsigned char           skipping;           // skipping messages older than options.since
+    char                    stamp[MAX_STAMP_LENGTH];    // most recently parsed timestamp text
+    size_t                  stamp_len;          // length of stamp, or zero if none
+    time_t                  stamp_time;         // most recently parsed timestamp
+    off_t                   msg_offset;         // reader offset of the log message being assembled, or -1
+    unsigned long           msg_lnum;           // line number of its first line
+    off_t                   msg_pos;            // file offset of its first line
+    size_t                  msg_size;           // buffer bytes it spans, including NUL terminators
+    unsigned char           msg_head;           // it starts with a first line, not continuation lines
+    struct message_line     *msg_lines;         // its lines
+    unsigned int            msg_num_lines;      // number of lines
+    unsigned int            msg_max_lines;      // length of msg_lines array
+    unsigned char           msg_hold;           // the last log message may be left unfinished at end of input
+    char                    error[ERROR_BUFFER_SIZE];
 };
 
 // Exit values
@@ -47,11 +228,15 @@ struct scan_state {
 extern const char *const logwarn_version;
 
 // Global functions
-extern void reset_state(struct scan_state *state);
-extern int  load_state(const char *state_file, struct scan_state *state);
-extern void save_state(const char *state_file, const char *logfile, const struct scan_state *state);
-extern void dump_state(FILE *fp, const char *logfile, const struct scan_state *state);
-extern void init_state_from_logfile(const char *logfile, struct scan_state *state);
-extern void state_file_name(const char *state_dir, const char *logfile, char *buf, size_t max);
-extern struct repeat *find_repeat(struct scan_state *state, unsigned int hash);
-
+extern struct repeat *logwarn_find_repeat(struct logwarn_state *state, unsigned int hash);
+extern int  logwarn_compile_pattern(struct repat *pat, const char *string, int eflags, char *errbuf, size_t errlen);
+extern void logwarn_free_pattern(struct repat *pat);
+extern int  logwarn_reader_init(struct reader *r, int fd, const char *name, int flags);
+extern void logwarn_reader_free(struct reader *r);
+extern void logwarn_reader_stream(struct reader *r, unsigned int idle_msecs);
+extern int  logwarn_reader_seek(struct reader *r, off_t pos);
+extern off_t logwarn_reader_offset(const struct reader *r, const char *ptr);
+extern const char *logwarn_reader_pointer(const struct reader *r, off_t offset);
+extern void logwarn_reader_keep(struct reader *r, off_t offset);
+extern char *logwarn_reader_getline(struct reader *r, size_t *lenp);
+extern void logwarn_reader_skip_lines(struct reader *r, unsigned long count);
@@ -23,11 +23,8 @@
 #include <sys/stat.h>
 
 #include <ctype.h>
-#include <dirent.h>
 #include <errno.h>
-#include <libgen.h>
 #include <limits.h>
-#include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,117 +34,165 @@
 #include "logwarn.h"
 
 // Definitions
-#ifndef DEFAULT_ROTPAT
-#define DEFAULT_ROTPAT          "^(-[[:digit:]]{8}|\\.[01])(\\.(gz|xz|bz2))?$"
-#endif
-
 #ifndef DEFAULT_STATE_DIR
 #define DEFAULT_STATE_DIR       "/var/lib/logwarn"
 #endif
 
-struct repat {
-    const char      *string;
-    regex_t         regex;
-    unsigned char   negate;
-    struct repeat   *repeat;
+// Additional rule set from `-S'
+struct rule_set {
+    char                        *name;          // rule set name
+    const char                  *file;          // rules file
+    struct logwarn_patterns     *patterns;      // patterns
+    struct logwarn_set_options  options;        // limits and output
+    const char                  *output_file;   // file opened for output, or NULL for stdout
+    int                         exit_value;     // exit value if matches are found
 };
 
 // Global variables
 static const char   *state_dir;
+static const char   *rules_file;
 static char         *state_file;
-static struct repat log_pattern;
-static struct repat rot_pattern;
-static int          default_match = 1;
-static int          auto_initialize;
-static int          num_match_patterns;
-static int          read_from_beginning;
-static int          match_last_rotated;
-static int          quiet;
-static int          any_matches;
 static int          line_numbers;
-static unsigned int error_count;
-static unsigned int line_count;
-static unsigned int max_errors_processed = UINT_MAX;
-static unsigned int max_errors_output = UINT_MAX;
-static unsigned int max_lines_output = UINT_MAX;
-static struct repat *match_patterns;
+static struct rule_set *rule_sets;
+static int          num_rule_sets;
 
 // Internal functions
-static void scan_file(const char *file, struct scan_state *state);
-static void parse_pattern(struct repat *pat, const char *string, int eflags);
+static logwarn_output_t output_line;
+static unsigned long long parse_size(const char *string);
+static int  read_rules_file(const char *file, int argc, char ***argvp);
+static void add_rule_set(const char *arg);
+static void read_rule_set(struct rule_set *rset, const struct logwarn_options *options);
+static unsigned int rules_hash(const struct logwarn_patterns *patterns);
+static void check_patterns(struct logwarn_patterns *patterns);
+static unsigned int parse_uint(const char *string, int flag);
+static time_t parse_time(const char *string, const char *format, int flag);
 static void version(void);
 static void usage(void);
 
 int
 main(int argc, char **argv)
 {
-    struct scan_state state;
+    struct logwarn_options options;
+    struct logwarn_patterns *patterns;
+    struct logwarn_scanner *scanner;
+    struct logwarn_state *state;
+    char ebuf[ERROR_BUFFER_SIZE];
+    const char *metrics_file = NULL;
+    const char *since = NULL;
+    const char *until = NULL;
     const char *logfile;
     struct stat sb;
-    const char *rotpat = DEFAULT_ROTPAT;
-    const char *mpat = NULL;
     char *eptr;
+    int nchars;
     int ignore_nonexistent = 0;
-    int eflags = 0;
+    int read_from_beginning = 0;
+    unsigned int hash;
+    int checked;
+    int loaded;
+    int auto_initialize = 0;
+    int default_match = 1;
     int initialize = 0;
+    int quiet = 0;
+    int pflags = 0;
+    int exit_value;
+    int first_rule;
+    int result;
     int envset;
     int i;
 
-    // Initialize state
-    memset(&state, 0, sizeof(state));
-    state.line = 1;
+    // Initialize options
+    logwarn_options_init(&options);
 
     // Make getopt() stop at the first non-flag argument
     if ((envset = (getenv("POSIXLY_CORRECT") == NULL)))
         setenv("POSIXLY_CORRECT", "", 1);
 
     // Parse command line
-    while ((i = getopt(argc, argv, "acd:f:hilL:m:M:N:npqRr:tvz")) != -1) {
+    while ((i = getopt(argc, argv, "A:B:ab:cd:De:f:H:hik:lL:m:M:N:nOP:pqRr:s:S:t:u:vWw:z")) != -1) {
         switch (i) {
+        case 'A':
+        case 'B':
+            if (i == 'A')
+                options.after_context = (unsigned int)strtoul(optarg, &eptr, 10);
+            else
+                options.before_context = (unsigned int)strtoul(optarg, &eptr, 10);
+            if (*optarg == '\0' || *eptr != '\0') {
+                fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, optarg, i);
+                exit(EXIT_ERROR);
+            }
+            break;
         case 'a':
             auto_initialize = 1;
             break;
+        case 'b':
+            if ((options.max_bytes = parse_size(optarg)) == 0) {
+                fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, optarg, i);
+                exit(EXIT_ERROR);
+            }
+            break;
         case 'c':
-            eflags |= REG_ICASE;
+            pflags |= LOGWARN_ICASE;
             break;
         case 'd':
             state_dir = optarg;
             break;
+        case 'D':
+            options.io_flags |= LOGWARN_NOCACHE;
+            break;
+        case 'e':
+            metrics_file = optarg;
+            break;
         case 'f':
             state_file = optarg;
             break;
+        case 'k':
+            options.time_format = optarg;
+            break;
         case 'm':
-            mpat = optarg;
+            options.multiline_pattern = optarg;
             break;
         case 'l':
             line_numbers = 1;
             break;
         case 'L':
-            max_lines_output = (unsigned int)strtoul(optarg, &eptr, 10);
+            options.max_lines_output = (unsigned int)strtoul(optarg, &eptr, 10);
             if (*optarg == '\0' || *eptr != '\0') {
                 fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, optarg, i);
                 exit(EXIT_ERROR);
             }
             break;
         case 'M':
-            max_errors_output = (unsigned int)strtoul(optarg, &eptr, 10);
+            options.max_errors_output = (unsigned int)strtoul(optarg, &eptr, 10);
             if (*optarg == '\0' || *eptr != '\0') {
                 fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, optarg, i);
                 exit(EXIT_ERROR);
             }
             break;
         case 'N':
-            max_errors_processed = (unsigned int)strtoul(optarg, &eptr, 10);
-            if (*optarg == '\0' || *eptr != '\0' || max_errors_processed == 0) {
+            options.max_errors_processed = (unsigned int)strtoul(optarg, &eptr, 10);
+            if (*optarg == '\0' || *eptr != '\0' || options.max_errors_processed == 0) {
                 fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, optarg, i);
                 exit(EXIT_ERROR);
             }
             break;
         case 'r':
-            rotpat = optarg;
+            options.rotated_pattern = optarg;
             break;
         case 'R':
-            match_last_rotated = 1;
+            options.match_last_rotated = 1;
+            break;
+        case 'H':
+            eptr = optarg;
+            nchars = -1;
+            if (sscanf(eptr, "%u%n", &options.cache_size, &nchars) == 1 && eptr[nchars] == '/') {
+                eptr += nchars + 1;
+                nchars = -1;
+                (void)sscanf(eptr, "%u%n", &options.cache_skip, &nchars);
+            }
+            if (nchars == -1 || eptr[nchars] != '\0' || options.cache_size == 0) {
+                fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, optarg, i);
+                exit(EXIT_ERROR);
+            }
             break;
         case 'h':
             usage();
@@ -158,12 +203,44 @@ main(int argc, char **argv)
         case 'n':
             ignore_nonexistent = 1;
             break;
+        case 'O':
+            options.io_flags |= LOGWARN_NOCACHE | LOGWARN_DIRECT;
+            break;
+        case 'P':
+            rules_file = optarg;
+            break;
         case 'p':
             default_match = 0;
             break;
         case 'q':
             quiet = 1;
             break;
+        case 's':
+            since = optarg;
+            break;
+        case 'S':
+            add_rule_set(optarg);
+            break;
+        case 't':
+            options.max_seconds = (unsigned int)strtoul(optarg, &eptr, 10);
+            if (*optarg == '\0' || *eptr != '\0' || options.max_seconds == 0) {
+                fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, optarg, i);
+                exit(EXIT_ERROR);
+            }
+            break;
+        case 'u':
+            until = optarg;
+            break;
+        case 'W':
+            options.whole_messages = 1;
+            break;
+        case 'w':
+            options.stream = 1;
+            if ((options.idle_msecs = parse_uint(optarg, i)) > INT_MAX) {
+                fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, optarg, i);
+                exit(EXIT_ERROR);
+            }
+            break;
         case 'z':
             read_from_beginning = 1;
             break;
@@ -178,8 +255,30 @@ main(int argc, char **argv)
     }
     if (envset)
         unsetenv("POSIXLY_CORRECT");
-    if (mpat != NULL)
-        parse_pattern(&log_pattern, mpat, eflags);
+    options.pattern_flags = pflags;
+    if ((since != NULL || until != NULL) && options.time_format == NULL) {
+        fprintf(stderr, "%s: `-s' and `-u' require `-k'\n", PACKAGE);
+        exit(EXIT_ERROR);
+    }
+    if (options.whole_messages && options.multiline_pattern == NULL) {
+        fprintf(stderr, "%s: `-W' requires `-m'\n", PACKAGE);
+        exit(EXIT_ERROR);
+    }
+    if (since != NULL)
+        options.since = parse_time(since, options.time_format, 's');
+    if (until != NULL)
+        options.until = parse_time(until, options.time_format, 'u');
+    if (!quiet) {
+        options.output = output_line;
+        options.output_arg = stdout;
+    }
+
+    // Create pattern set
+    if ((patterns = logwarn_patterns_create(default_match)) == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, "malloc", strerror(errno));
+        exit(EXIT_ERROR);
+    }
+
     argv += optind;
     argc -= optind;
     switch (argc) {
@@ -192,6 +291,10 @@ main(int argc, char **argv)
         logfile = argv[0];
         if (strcmp(logfile, "-") == 0)
             logfile = NULL;
+        else if (options.stream) {
+            fprintf(stderr, "%s: `-w' requires a logfile of `-'\n", PACKAGE);
+            exit(EXIT_ERROR);
+        }
         argv++;
         argc--;
 
@@ -204,66 +307,67 @@ main(int argc, char **argv)
             break;
         }
 
-        // Allocate pattern array
-        if ((match_patterns = malloc(argc * sizeof(*match_patterns))) == NULL
-          || (state.repeats = malloc(argc * sizeof(*state.repeats))) == NULL) {
-            fprintf(stderr, "%s: %s: %s\n", PACKAGE, "malloc", strerror(errno));
-            exit(EXIT_ERROR);
-        }
-        memset(match_patterns, 0, argc * sizeof(*match_patterns));
-        memset(state.repeats, 0, argc * sizeof(*state.repeats));
+        // Append patterns from the rules file, if any
+        first_rule = argc;
+        if (rules_file != NULL)
+            argc = read_rules_file(rules_file, argc, &argv);
 
-        // Parse patterns and `-T' flags
+        // Parse patterns and `-T' flags; compilation is deferred until there is something to match (see rules_hash())
         for (i = 0; i < argc; i++) {
-            struct repat *const pat = &match_patterns[num_match_patterns];
-            char *patstr = argv[i];
+            unsigned int num;
+            unsigned int secs;
 
             // Add new repeat?
-            if (strcmp(patstr, "-T") == 0) {
-                struct repeat *const repeat = &state.repeats[state.num_repeats];
-
-                if (++i >= argc || sscanf(argv[i], "%u/%u", &repeat->num, &repeat->secs) != 2) {
+            if (strcmp(argv[i], "-T") == 0) {
+                if (++i >= argc || sscanf(argv[i], "%u/%u", &num, &secs) != 2) {
                     usage();
                     exit(EXIT_ERROR);
                 }
-                if (repeat->num == 0) {
-                    fprintf(stderr, "%s: invalid zero repeat count in \"-T %s\"", PACKAGE, argv[i]);
+                if (logwarn_patterns_add_repeat(patterns, num, secs) == -1) {
+                    fprintf(stderr, "%s: %s\n", PACKAGE, logwarn_patterns_error(patterns));
                     exit(EXIT_ERROR);
                 }
-                state.num_repeats++;
-                if ((repeat->occurrences = malloc(repeat->num * sizeof(repeat->occurrences))) == NULL) {
-                    fprintf(stderr, "%s: %s: %s\n", PACKAGE, "malloc", strerror(errno));
-                    exit(EXIT_ERROR);
-                }
-                memset(repeat->occurrences, 0, repeat->num * sizeof(*repeat->occurrences));
                 continue;
             }
 
-            // It's a new pattern
-            num_match_patterns++;
+            // Rules file may enable case-insensitive matching for subsequent patterns
+            if (i >= first_rule && strcmp(argv[i], "-c") == 0) {
+                pflags |= LOGWARN_ICASE;
+                continue;
+            }
 
-            // Check for negation
-            if (*patstr == '!') {
-                patstr++;
-                pat->negate = 1;
+            // It's a new pattern
+            if (logwarn_patterns_add(patterns, argv[i], pflags) == -1) {
+                fprintf(stderr, "%s: %s\n", PACKAGE, logwarn_patterns_error(patterns));
+                exit(EXIT_ERROR);
             }
+        }
+        break;
+    }
 
-            // Add (positive) pattern to the current repeat, if any
-            if (!pat->negate && state.num_repeats > 0) {
-                struct repeat *const current_repeat = &state.repeats[state.num_repeats - 1];
-                unsigned int hash = 0;
-                const char *s;
+    // Read additional rule sets
+    for (i = 0; i < num_rule_sets; i++)
+        read_rule_set(&rule_sets[i], &options);
 
-                for (s = patstr; *s != '\0'; s++)
-                    hash = hash * 37 + (unsigned char)*s;
-                current_repeat->hash ^= hash;
-                pat->repeat = current_repeat;
-            }
+    // Without any patterns of its own, the command line only serves to name the rule sets
+    if (num_rule_sets > 0 && argc == 0) {
+        logwarn_patterns_free(patterns);
+        patterns = NULL;
+    }
 
-            // Parse pattern
-            parse_pattern(pat, patstr, eflags);
+    // Initialize state
+    if ((state = logwarn_state_create(patterns)) == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, "malloc", strerror(errno));
+        exit(EXIT_ERROR);
+    }
+    for (i = 0; i < num_rule_sets; i++) {
+        if (logwarn_state_add_set(state, rule_sets[i].name, rule_sets[i].patterns) == -1) {
+            if (errno == EINVAL)
+                fprintf(stderr, "%s: invalid or duplicate rule set name `%s'\n", PACKAGE, rule_sets[i].name);
+            else
+                fprintf(stderr, "%s: %s: %s\n", PACKAGE, "malloc", strerror(errno));
+            exit(EXIT_ERROR);
         }
-        break;
     }
 
     // Check "-d" vs. "-f" and determine state file
@@ -278,12 +382,9 @@ main(int argc, char **argv)
             fprintf(stderr, "%s: %s: %s\n", PACKAGE, "malloc", strerror(errno));
             exit(EXIT_ERROR);
         }
-        state_file_name(state_dir, logfile, state_file, PATH_MAX);
+        logwarn_state_file_name(state_dir, logfile, state_file, PATH_MAX);
     }
 
-    // Parse rotated file pattern
-    parse_pattern(&rot_pattern, rotpat, 0);
-
     // Check if logfile exists
     if (logfile != NULL && stat(logfile, &sb) == -1) {
         switch (errno) {
@@ -301,8 +402,14 @@ main(int argc, char **argv)
 
     // Handle explicit initialization case
     if (initialize) {
-        init_state_from_logfile(logfile, &state);
-        save_state(state_file, logfile, &state);
+        if (logwarn_init_state_from_logfile(logfile, state) == -1) {
+            fprintf(stderr, "%s: %s: %s\n", PACKAGE, logfile, strerror(errno));
+            exit(EXIT_ERROR);
+        }
+        if (logwarn_save_state(state_file, logfile, state) == -1) {
+            fprintf(stderr, "%s: %s: %s\n", PACKAGE, state_file, strerror(errno));
+            exit(EXIT_ERROR);
+        }
         exit(EXIT_OK);
     }
 
@@ -310,322 +417,438 @@ main(int argc, char **argv)
     // run after explicit initialization if logfile previously did not
     // exist (in which case we would not have created a saved state file).
     // Also avoids repeats when we can't save our state for some reason.
-    if (load_state(state_file, &state) == -1 && auto_initialize)
-        init_state_from_logfile(logfile, &state);
+    if (!(loaded = logwarn_load_state(state_file, state) != -1) && auto_initialize
+      && logwarn_init_state_from_logfile(logfile, state) == -1) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, logfile, strerror(errno));
+        exit(EXIT_ERROR);
+    }
 
     // Read from beginning?
-    if (read_from_beginning) {
-        state.line = 1;
-        state.pos = 0;
-    }
-
-    // Has log file rotated since we last checked?
-    // If so, scan the rotated file first
-    if (logfile != NULL && sb.st_ino != state.inode) {
-        char *rotated = NULL;
-        char *dname;
-        char *bname;
-        char *temp;
-        DIR *dir;
-
-        // Get directory and filename of file containing logfile
-        if ((temp = strdup(logfile)) == NULL || (bname = strdup(basename(temp))) == NULL) {
-            fprintf(stderr, "%s: %s: %s\n", PACKAGE, "strdup", strerror(errno));
-            exit(EXIT_ERROR);
-        }
-        free(temp);
-        if ((temp = strdup(logfile)) == NULL || (dname = strdup(dirname(temp))) == NULL) {
-            fprintf(stderr, "%s: %s: %s\n", PACKAGE, "strdup", strerror(errno));
+    if (read_from_beginning)
+        logwarn_rewind_state(state);
+
+    // Patterns are compiled when first needed, so unless the state file says these rules have compiled before,
+    // any not needed by this run must still be checked
+    hash = rules_hash(patterns);
+    checked = logwarn_state_rules_hash(state) == hash;
+
+    // If nothing has been appended since last time, there's nothing to do, not even compiling any patterns or
+    // rewriting the state file. This only applies to a state we actually loaded; an auto-initialized state must
+    // still be saved.
+    if (loaded && checked && logfile != NULL && !read_from_beginning
+      && (metrics_file == NULL || access(metrics_file, F_OK) == 0)) {
+        int current = 1;
+
+        for (i = patterns == NULL; current && i <= num_rule_sets; i++)
+            current = logwarn_state_is_current(logwarn_state_set(state, i), sb.st_ino, sb.st_size);
+        if (current)
+            exit(EXIT_OK);
+    }
+
+    // Create scanner; this compiles the first line and rotated file patterns
+    if ((scanner = logwarn_scanner_create(patterns, &options, ebuf, sizeof(ebuf))) == NULL) {
+        fprintf(stderr, "%s: %s\n", PACKAGE, ebuf);
+        exit(EXIT_ERROR);
+    }
+    for (i = 0; i < num_rule_sets; i++) {
+        if (logwarn_scanner_add_set(scanner, rule_sets[i].patterns, &rule_sets[i].options) == -1) {
+            fprintf(stderr, "%s: %s\n", PACKAGE, logwarn_scanner_error(scanner));
             exit(EXIT_ERROR);
         }
-        free(temp);
-
-        // Search for rotated version in same directory
-        if ((dir = opendir(dname)) != NULL) {
-            const size_t bnamelen = strlen(bname);
-            struct dirent *ent;
-
-            for (ent = readdir(dir); ent != NULL; ent = readdir(dir)) {
-                int prefer;
-                int diff;
-
-                // Rotated file must have logfile name as prefix
-                if (strncmp(ent->d_name, bname, bnamelen) != 0)
-                    continue;
-
-                // Skip the file itself
-                if (ent->d_name[bnamelen] == '\0')
-                    continue;
-
-                // Compare rotated file against pattern
-                if (regexec(&rot_pattern.regex, ent->d_name + bnamelen, 0, NULL, 0) != 0)
-                    continue;
-
-                // It's a candidate. Pick the first (or last) one in sorting order.
-                if (rotated == NULL)
-                    prefer = 1;
-                else {
-                    diff = strcmp(ent->d_name, rotated);
-                    prefer = match_last_rotated ? diff > 0 : diff < 0;
-                }
-                if (prefer) {
-                    if ((rotated = realloc(rotated, strlen(ent->d_name) + 1)) == NULL) {
-                        fprintf(stderr, "%s: %s: %s\n", PACKAGE, "realloc", strerror(errno));
-                        exit(EXIT_ERROR);
-                    }
-                    strcpy(rotated, ent->d_name);
-                }
-            }
-            closedir(dir);
-        }
+    }
+
+    // Scan the log file, and its rotated predecessor if necessary
+    if ((result = logwarn_scan(scanner, logfile, state)) == -1) {
+        fprintf(stderr, "%s: %s\n", PACKAGE, logwarn_scanner_error(scanner));
+        exit(EXIT_ERROR);
+    }
+
+    // Check any patterns not needed yet, and remember that these rules compile
+    if (!checked) {
+        check_patterns(patterns);
+        for (i = 0; i < num_rule_sets; i++)
+            check_patterns(rule_sets[i].patterns);
+        logwarn_state_set_rules_hash(state, hash);
+    }
 
-        // Scan rotated file first, assuming it's the previous version
-        if (rotated != NULL) {
-            char buf[PATH_MAX];
+    // Close rule set output files; if any output was lost, don't move past it
+    for (i = 0; i < num_rule_sets; i++) {
+        const struct rule_set *const rset = &rule_sets[i];
+        FILE *const fp = rset->options.output_arg;
 
-            snprintf(buf, sizeof(buf), "%s/%s", dname, rotated);
-            scan_file(buf, &state);
+        if (rset->output_file != NULL && (ferror(fp) || fclose(fp) == EOF)) {
+            fprintf(stderr, "%s: %s: %s\n", PACKAGE, rset->output_file, strerror(errno));
+            exit(EXIT_ERROR);
         }
+    }
 
-        // Clean up
-        free(dname);
-        free(bname);
-        free(rotated);
+    // Save updated state
+    if (logwarn_save_state(state_file, logfile, state) == -1) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, state_file, strerror(errno));
+        exit(EXIT_ERROR);
+    }
 
-        // Update state for new file
-        state.inode = sb.st_ino;
-        state.line = 1;
-        state.pos = 0;
+    // Export metrics
+    if (metrics_file != NULL && logwarn_write_metrics(scanner, metrics_file, logfile, state) == -1) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, metrics_file, strerror(errno));
+        exit(EXIT_ERROR);
     }
 
-    // Check whether the file has been truncated in place
-    if (logfile != NULL && state.pos > (long)sb.st_size) {
-        state.line = 1;
-        state.pos = 0;
-        state.matching = 0;
+    // Report a partial scan
+    if ((result & LOGWARN_PARTIAL) != 0)
+        fprintf(stderr, "%s: %s: scan limit reached; log only partially scanned\n", PACKAGE, logfile != NULL ? logfile : "(stdin)");
+
+    // Done; if more than one rule set found matches, use the highest exit value
+    exit_value = logwarn_scanner_matched(scanner, 0) ? EXIT_MATCHES : EXIT_OK;
+    for (i = 0; i < num_rule_sets; i++) {
+        if (logwarn_scanner_matched(scanner, i + 1) && rule_sets[i].exit_value > exit_value)
+            exit_value = rule_sets[i].exit_value;
     }
+    exit(exit_value);
+}
 
-    // Now scan the logfile itself
-    scan_file(logfile, &state);
+static void
+output_line(void *arg, int type, unsigned long lnum, const char *line)
+{
+    FILE *const fp = arg;
 
-    // Done
-    exit(any_matches ? EXIT_MATCHES : EXIT_OK);
+    if (type == LOGWARN_LINE_SEPARATOR) {
+        fprintf(fp, "--\n");
+        return;
+    }
+    if (type == LOGWARN_LINE_FLUSH) {
+        fflush(fp);
+        return;
+    }
+    if (line_numbers) {
+        const char sep = type == LOGWARN_LINE_CONTEXT ? '-' : ':';
+        const char *nl;
+
+        // With `-W', a matching log message is output all at once
+        for (; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+            fprintf(fp, "%lu%c", lnum++, sep);
+            fwrite(line, 1, nl - line + 1, fp);
+        }
+        fprintf(fp, "%lu%c", lnum, sep);
+    }
+    fputs(line, fp);
+    putc('\n', fp);
 }
 
+/*
+ * Record a `-S name=rulesfile' flag.
+ */
 static void
-scan_file(const char *logfile, struct scan_state *state)
+add_rule_set(const char *arg)
 {
-    unsigned char compressed = 0;
-    char cmdbuf[PATH_MAX];
-    char *line = NULL;
-    FILE *fp;
-    int ch;
-    int i;
+    struct rule_set *rset;
+    const char *eq;
 
-    // Open file
-    if (logfile == NULL)
-        fp = stdin;
-    else if ((fp = fopen(logfile, "r")) == NULL) {
-        fprintf(stderr, "%s: %s: %s\n", PACKAGE, logfile, strerror(errno));
+    if ((eq = strchr(arg, '=')) == NULL || eq == arg || eq[1] == '\0') {
+        fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, arg, 'S');
         exit(EXIT_ERROR);
     }
-
-    // Check for compressed file and if so decode gzip/xz/bzip2 on the fly
-    if (logfile != NULL) {
-        const char *cmdfmt = NULL;
-        unsigned char magic[6];
-
-        if (fread(magic, sizeof(magic), 1, fp) == 1) {
-            if (magic[0] == 0x1f && magic[1] == 0x8b)
-                cmdfmt = "gunzip -c '%s'";
-            else if (magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h')
-                cmdfmt = "bunzip2 -c '%s'";
-            else if (magic[0] == 0xfd && magic[1] == 0x37 && magic[2] == 0x7a
-              && magic[3] == 0x58 && magic[4] == 0x5a && magic[5] == 0x00)
-                cmdfmt = "unxz -c '%s'";
-            if (cmdfmt != NULL) {
-                (void)fclose(fp);
-                snprintf(cmdbuf, sizeof(cmdbuf), cmdfmt, logfile);
-                if ((fp = popen(cmdbuf, "r")) == NULL) {
-                    fprintf(stderr, "%s: can't invoke \"%s\": %s\n", PACKAGE, cmdbuf, strerror(errno));
-                    exit(EXIT_ERROR);
-                }
-                compressed = 1;
-            }
-        } else if (ferror(fp)) {
-            fprintf(stderr, "%s: %s: %s\n", PACKAGE, logfile, strerror(errno));
-            exit(EXIT_ERROR);
-        }
+    if ((rule_sets = realloc(rule_sets, (num_rule_sets + 1) * sizeof(*rule_sets))) == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, "realloc", strerror(errno));
+        exit(EXIT_ERROR);
     }
+    rset = &rule_sets[num_rule_sets++];
+    memset(rset, 0, sizeof(*rset));
+    if ((rset->name = strndup(arg, eq - arg)) == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, "strndup", strerror(errno));
+        exit(EXIT_ERROR);
+    }
+    rset->file = eq + 1;
+}
 
-    // Rewind to the beginning
-    if (logfile != NULL && !compressed)
-        rewind(fp);
+/*
+ * Read a rule set's rules file. In addition to what `-P' allows, a rule set's rules file may
+ * contain `-p', `-M num', `-N num', `-o file', and `-x value' lines, which apply to the whole set.
+ */
+static void
+read_rule_set(struct rule_set *rset, const struct logwarn_options *options)
+{
+    int pflags = options->pattern_flags;
+    const char *output_file = NULL;
+    int default_match = 1;
+    char **args = NULL;
+    int nargs;
+    int i;
 
-    // Skip past lines already scanned
-    if (state->pos != 0) {
-        if (fseek(fp, state->pos, SEEK_CUR) == -1) {
-            for (i = 1; i < state->line; i++) {
-                while ((ch = getc(fp)) != EOF) {
-                    if (ch == '\n')
-                        break;
-                }
-                if (ch == EOF)
-                    break;
+    // Defaults come from the command line
+    logwarn_set_options_init(&rset->options);
+    rset->options.max_errors_processed = options->max_errors_processed;
+    rset->options.max_errors_output = options->max_errors_output;
+    rset->exit_value = EXIT_MATCHES;
+
+    // Read rules file and apply settings
+    nargs = read_rules_file(rset->file, 0, &args);
+    for (i = 0; i < nargs; i++) {
+        const char *const arg = args[i];
+        const char *value;
+
+        if (strcmp(arg, "-p") == 0) {
+            default_match = 0;
+            continue;
+        }
+        if (arg[0] != '-' || arg[1] == '\0' || strchr("MNox", arg[1]) == NULL)
+            continue;
+        for (value = arg + 2; isspace((unsigned char)*value); value++)
+            ;
+        if (value == arg + 2 || *value == '\0') {
+            fprintf(stderr, "%s: %s: invalid `-%c' line\n", PACKAGE, rset->file, arg[1]);
+            exit(EXIT_ERROR);
+        }
+        switch (arg[1]) {
+        case 'M':
+            rset->options.max_errors_output = parse_uint(value, arg[1]);
+            break;
+        case 'N':
+            if ((rset->options.max_errors_processed = parse_uint(value, arg[1])) == 0) {
+                fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, value, arg[1]);
+                exit(EXIT_ERROR);
             }
+            break;
+        case 'o':
+            output_file = value;
+            break;
+        case 'x':
+            rset->exit_value = parse_uint(value, arg[1]);
+            if (rset->exit_value == 0 || rset->exit_value == EXIT_ERROR || rset->exit_value > 255) {
+                fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, value, arg[1]);
+                exit(EXIT_ERROR);
+            }
+            break;
         }
+        args[i] = NULL;
     }
 
-    // Allocate line buffer
-    if ((line = malloc(MAX_LINE_LENGTH)) == NULL) {
+    // Create pattern set
+    if ((rset->patterns = logwarn_patterns_create(default_match)) == NULL) {
         fprintf(stderr, "%s: %s: %s\n", PACKAGE, "malloc", strerror(errno));
         exit(EXIT_ERROR);
     }
-
-    // Scan lines
-    while (1) {
-        unsigned char continuation;
-        int newline = 0;
-        int len;
-
-        // Read next line, or up to MAX_LINE_LENGTH of it
-        for (len = 0; len < MAX_LINE_LENGTH - 1; ) {
-            if ((ch = getc(fp)) == -1) {
-                line[len] = '\0';
-                break;
+    for (i = 0; i < nargs; i++) {
+        unsigned int num;
+        unsigned int secs;
+
+        // Skip settings already handled
+        if (args[i] == NULL || strcmp(args[i], "-p") == 0)
+            continue;
+
+        // Add new repeat?
+        if (strcmp(args[i], "-T") == 0) {
+            if (++i >= nargs || sscanf(args[i], "%u/%u", &num, &secs) != 2) {
+                fprintf(stderr, "%s: %s: invalid `-T' line\n", PACKAGE, rset->file);
+                exit(EXIT_ERROR);
             }
-            if (ch == '\n') {
-                line[len++] = '\0';     // count newline but omit from buffer
-                newline = 1;
-                break;
+            if (logwarn_patterns_add_repeat(rset->patterns, num, secs) == -1) {
+                fprintf(stderr, "%s: %s\n", PACKAGE, logwarn_patterns_error(rset->patterns));
+                exit(EXIT_ERROR);
             }
-            line[len++] = ch;
+            continue;
         }
 
-        // End of file?
-        if (len == 0 || (len < MAX_LINE_LENGTH - 1 && !newline))
-            break;
-
-        // Is this a new log entry or a continuation line?
-        continuation = log_pattern.string != NULL && regexec(&log_pattern.regex, line, 0, NULL, 0) != 0;
+        // Enable case-insensitive matching for subsequent patterns?
+        if (strcmp(args[i], "-c") == 0) {
+            pflags |= LOGWARN_ICASE;
+            continue;
+        }
 
-        // If this is not a continuation, check if we have reached our limit on the number of errors processed
-        if (!continuation && error_count >= max_errors_processed)
-            break;
+        // It's a new pattern
+        if (logwarn_patterns_add(rset->patterns, args[i], pflags) == -1) {
+            fprintf(stderr, "%s: %s\n", PACKAGE, logwarn_patterns_error(rset->patterns));
+            exit(EXIT_ERROR);
+        }
+    }
 
-        // Bump position and number of lines read
-        state->pos += len;
-        state->line++;
+    // Open output destination
+    if (options->output == NULL)
+        return;
+    rset->options.output = options->output;
+    if (output_file == NULL) {
+        rset->options.output_arg = stdout;
+        return;
+    }
+    if ((rset->options.output_arg = fopen(output_file, "ae")) == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, output_file, strerror(errno));
+        exit(EXIT_ERROR);
+    }
+    rset->output_file = output_file;
+}
 
-        // Does this line match? New log entries lines only.
-        if (!continuation) {
-            int matches = -1;
+/*
+ * Compile a pattern set, if not already done, and bail out if any pattern is invalid.
+ */
+static void
+check_patterns(struct logwarn_patterns *patterns)
+{
+    if (patterns != NULL && logwarn_patterns_compile(patterns) == -1) {
+        fprintf(stderr, "%s: %s\n", PACKAGE, logwarn_patterns_error(patterns));
+        exit(EXIT_ERROR);
+    }
+}
 
-            // Determine if this line matches
-            for (i = 0; i < num_match_patterns; i++) {
-                const struct repat *const pat = &match_patterns[i];
-                struct repeat *const repeat = pat->repeat;
+/*
+ * Hash the patterns of every rule set, along with our version, for recording in the state file once they compile.
+ */
+static unsigned int
+rules_hash(const struct logwarn_patterns *patterns)
+{
+    unsigned int hash = 0;
+    const char *s;
+    int i;
 
-                if (regexec(&pat->regex, line, 0, NULL, 0) == 0) {
+    for (s = logwarn_version; *s != '\0'; s++)
+        hash = hash * 37 + (unsigned char)*s;
+    hash = logwarn_patterns_hash(patterns, hash);
+    for (i = 0; i < num_rule_sets; i++)
+        hash = logwarn_patterns_hash(rule_sets[i].patterns, hash * 37 + 1);
+    return hash != 0 ? hash : 1;
+}
 
-                    // Check for repeat suppression
-                    if (repeat != NULL) {
-                        time_t now;
-                        int count;
+/*
+ * Parse an unsigned integer argument to a flag.
+ */
+static unsigned int
+parse_uint(const char *string, int flag)
+{
+    unsigned int value;
+    char *eptr;
 
-                        // Update timestamps by adding the current timestamp to the front of the array
-                        time(&now);
-                        memmove(repeat->occurrences + 1, repeat->occurrences, (repeat->num - 1) * sizeof(*repeat->occurrences));
-                        repeat->occurrences[0] = (unsigned long)now;
+    value = (unsigned int)strtoul(string, &eptr, 10);
+    if (*string == '\0' || *eptr != '\0') {
+        fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, string, flag);
+        exit(EXIT_ERROR);
+    }
+    return value;
+}
 
-                        // Check whether the repeat threshold has been exceeded
-                        for (count = 0; count < repeat->num && repeat->occurrences[count] != 0; count++) {
-                            const unsigned int age = repeat->occurrences[0] - repeat->occurrences[count];
+/*
+ * Parse a `-s' or `-u' time, given either as `@' followed by seconds since the epoch or in timestamp format.
+ */
+static time_t
+parse_time(const char *string, const char *format, int flag)
+{
+    time_t value;
+    char *eptr;
 
-                            if (age > repeat->secs)
-                                break;
-                        }
+    if (*string == '@') {
+        value = (time_t)strtoll(string + 1, &eptr, 10);
+        if (eptr == string + 1 || *eptr != '\0' || value <= 0)
+            goto invalid;
+    } else if (logwarn_parse_time(format, string, time(NULL), &value) == -1 || value <= 0)
+        goto invalid;
+    return value;
+
+invalid:
+    fprintf(stderr, "%s: invalid argument `%s' to `-%c' flag\n", PACKAGE, string, flag);
+    exit(EXIT_ERROR);
+}
 
-                        // If not, treat like a non-matching line
-                        if (count < repeat->num) {
-                            matches = 0;
-                            break;
-                        }
+/*
+ * Parse a byte count with optional K, M, or G suffix. Returns zero if invalid.
+ */
+static unsigned long long
+parse_size(const char *string)
+{
+    unsigned long long value;
+    char *eptr;
 
-                        // If so, reset occurrence history for this pattern group
-                        memset(repeat->occurrences, 0, repeat->num * sizeof(*repeat->occurrences));
-                    }
+    value = strtoull(string, &eptr, 10);
+    if (eptr == string)
+        return 0;
+    switch (*eptr) {
+    case 'G':
+    case 'g':
+        value *= 1024;
+        // FALLTHROUGH
+    case 'M':
+    case 'm':
+        value *= 1024;
+        // FALLTHROUGH
+    case 'K':
+    case 'k':
+        value *= 1024;
+        eptr++;
+        break;
+    default:
+        break;
+    }
+    return *eptr == '\0' ? value : 0;
+}
 
-                    // No repeat suppression
-                    matches = pat->negate ? 0 : 1;
-                    break;
-                }
-            }
-            if (matches == -1)
-                matches = default_match;
+/*
+ * Read patterns from a rules file and append them to the given argument list.
+ * Each non-blank line not starting with `#' is a single pattern, `-T num/secs', or `-c'.
+ * Returns the new number of arguments.
+ */
+static int
+read_rules_file(const char *file, int argc, char ***argvp)
+{
+    static char tflag[] = "-T";
+    char buf[MAX_LINE_LENGTH];
+    char **args;
+    int nargs;
+    FILE *fp;
 
-            // Update error count
-            if (matches)
-                error_count++;
+    // Start with the arguments from the command line
+    nargs = argc;
+    if ((args = malloc((nargs + 2) * sizeof(*args))) == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, "malloc", strerror(errno));
+        exit(EXIT_ERROR);
+    }
+    memcpy(args, *argvp, nargs * sizeof(*args));
 
-            // Update matching state
-            state->matching = matches;
-        }
+    // Read rules file
+    if ((fp = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, file, strerror(errno));
+        exit(EXIT_ERROR);
+    }
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        size_t len = strlen(buf);
+        char *arg = buf;
 
-        // Reset line counter
-        if (!continuation)
-            line_count = 0;
+        // Trim line terminator
+        while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+            buf[--len] = '\0';
 
-        // Output line if it matches
-        if (state->matching) {
+        // Ignore blank lines and comments
+        if (len == 0 || *buf == '#')
+            continue;
 
-            // Update flag
-            any_matches = 1;
+        // Make room for up to two more arguments
+        if ((args = realloc(args, (nargs + 2) * sizeof(*args))) == NULL) {
+            fprintf(stderr, "%s: %s: %s\n", PACKAGE, "realloc", strerror(errno));
+            exit(EXIT_ERROR);
+        }
 
-            // Output line if appropriate
-            if (!quiet && line_count < max_lines_output && error_count <= max_errors_output) {
-                if (line_numbers)
-                    printf("%ld:", state->line - 1);
-                printf("%s\n",line);
+        // Split "-T num/secs" into two arguments
+        if (strncmp(arg, "-T", 2) == 0 && (arg[2] == '\0' || isspace((unsigned char)arg[2]))) {
+            args[nargs++] = tflag;
+            for (arg += 2; isspace((unsigned char)*arg); arg++)
+                ;
+            if (*arg == '\0') {
+                fprintf(stderr, "%s: %s: invalid `-T' line\n", PACKAGE, file);
+                exit(EXIT_ERROR);
             }
-
-            // Update line and error counters
-            line_count++;
         }
-    }
-
-    // Save updated state
-    save_state(state_file, logfile, state);
-
-    // Free buffer
-    free(line);
 
-    // Close file
-    if (compressed) {
-        if (pclose(fp) == -1) {
-            fprintf(stderr, "%s: %s: %s: %s\n", PACKAGE, "pclose", logfile, strerror(errno));
-            exit(EXIT_ERROR);
-        }
-    } else {
-        if (logfile != NULL && fclose(fp) == EOF) {
-            fprintf(stderr, "%s: %s: %s: %s\n", PACKAGE, "fclose", logfile, strerror(errno));
+        // Add argument
+        if ((args[nargs++] = strdup(arg)) == NULL) {
+            fprintf(stderr, "%s: %s: %s\n", PACKAGE, "strdup", strerror(errno));
             exit(EXIT_ERROR);
         }
     }
-}
-
-static void
-parse_pattern(struct repat *pat, const char *string, int eflags)
-{
-    char ebuf[1024];
-    int r;
-
-    if ((r = regcomp(&pat->regex, string, REG_EXTENDED|REG_NOSUB|eflags)) != 0) {
-        regerror(r, &pat->regex, ebuf, sizeof(ebuf));
-        fprintf(stderr, "%s: invalid regular expression \"%s\": %s", PACKAGE, string, ebuf);
+    if (ferror(fp)) {
+        fprintf(stderr, "%s: %s: %s\n", PACKAGE, file, strerror(errno));
         exit(EXIT_ERROR);
     }
-    pat->string = string;
+    (void)fclose(fp);
+
+    // Done
+    *argvp = args;
+    return nargs;
 }
 
 static void
@@ -633,25 +856,44 @@ usage(void)
 {
     fprintf(stderr, "Usage:\n");
     fprintf(stderr, "  logwarn [-d dir | -f file] [-m firstpat] [-r sufpat] [-L maxlines]\n");
-    fprintf(stderr, "          [-M maxprint] [-N maxerrors] [-achlnqpvz] logfile [-T num/secs] [!]pattern ...\n");
+    fprintf(stderr, "          [-M maxprint] [-N maxerrors] [-b maxbytes] [-t maxsecs]\n");
+    fprintf(stderr, "          [-A num] [-B num] [-P rulesfile] [-S name=rulesfile]\n");
+    fprintf(stderr, "          [-k timefmt [-s since] [-u until]] [-e metricsfile]\n");
+    fprintf(stderr, "          [-H entries[/skip]] [-w msecs]\n");
+    fprintf(stderr, "          [-acDhlnOqpvWz] logfile [-T num/secs] [!]pattern ...\n");
     fprintf(stderr, "  logwarn [-d dir | -f file] -i logfile\n");
     fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -A    Output `num' lines of context after matching log messages\n");
+    fprintf(stderr, "  -B    Output `num' lines of context before matching log messages\n");
     fprintf(stderr, "  -a    Auto-init: force `-i' if no state file exists\n");
+    fprintf(stderr, "  -b    Stop after scanning `maxbytes' bytes (K, M, G suffixes allowed)\n");
     fprintf(stderr, "  -c    Match patterns (and firstpat) case-insensitively\n");
     fprintf(stderr, "  -d    Specify state directory; default \"%s\"\n", DEFAULT_STATE_DIR);
+    fprintf(stderr, "  -D    Drop scanned file data from the page cache\n");
+    fprintf(stderr, "  -e    Write cumulative counters to metricsfile in Prometheus text format\n");
     fprintf(stderr, "  -f    Specify state file directly\n");
+    fprintf(stderr, "  -H    Cache match results for up to `entries' distinct lines, ignoring `skip' leading chars\n");
     fprintf(stderr, "  -h    Output this help message and exit\n");
     fprintf(stderr, "  -i    Initialize state as `up to date' (implies -n)\n");
+    fprintf(stderr, "  -k    Log messages start with a timestamp in strptime(3) format timefmt\n");
     fprintf(stderr, "  -L    Specify maximum number of lines to output per log message\n");
     fprintf(stderr, "  -l    Prefix each output line with the line number from the log file\n");
     fprintf(stderr, "  -m    Enable multi-line support; first lines start with firstpat\n");
     fprintf(stderr, "  -M    Specify maximum number of log messages to output\n");
     fprintf(stderr, "  -N    Specify maximum number of log messages to process\n");
     fprintf(stderr, "  -n    A nonexistent log file is not an error; treat as empty\n");
+    fprintf(stderr, "  -O    Read files using direct I/O (implies -D)\n");
+    fprintf(stderr, "  -P    Read additional patterns from rulesfile, one per line\n");
     fprintf(stderr, "  -q    Don't output the matched log messages\n");
     fprintf(stderr, "  -r    Specify rotated file suffix pattern; default \"%s\"\n", DEFAULT_ROTPAT);
+    fprintf(stderr, "  -s    Skip log messages timestamped before `since' (timefmt or @seconds)\n");
+    fprintf(stderr, "  -S    Also evaluate the named rule set read from rulesfile\n");
+    fprintf(stderr, "  -t    Stop after running for `maxsecs' seconds\n");
     fprintf(stderr, "  -T    Suppress until `num' occurrences within `secs' seconds\n");
+    fprintf(stderr, "  -u    Stop at the first log message timestamped at or after `until'\n");
     fprintf(stderr, "  -v    Output version information and exit\n");
+    fprintf(stderr, "  -W    Match patterns against whole multi-line log messages (requires -m)\n");
+    fprintf(stderr, "  -w    Stream standard input; flush output when idle for `msecs' (0 = after each match)\n");
     fprintf(stderr, "  -z    Always read from the beginning of the input\n");
     fprintf(stderr, "A logfile of `-' means read from standard input (typically used with `-z')\n");
 }
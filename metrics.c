@@ -0,0 +1,227 @@
+/*
+ * Logwarn - Utility for finding interesting messages in log files
+ *
+ * Copyright (C) 2010-2011 Archie L. Cobbs. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logwarn.h"
+
+// Definitions
+#define STDIN_LOGFILE_LABEL     "(stdin)"
+
+// Per-log file metrics
+static const struct {
+    const char  *name;
+    const char  *help;
+    size_t      offset;
+    int         cache;              // only relevant when the match verdict cache is enabled
+} metrics[] = {
+    { "logwarn_messages_total",     "Log messages scanned.",                              offsetof(struct scan_stats, messages),     0 },
+    { "logwarn_matches_total",      "Matching log messages.",                             offsetof(struct scan_stats, matches),      0 },
+    { "logwarn_suppressed_total",   "Matching log messages suppressed by repeat limits.", offsetof(struct scan_stats, suppressed),   0 },
+    { "logwarn_lines_total",        "Lines scanned.",                                     offsetof(struct scan_stats, lines),        0 },
+    { "logwarn_bytes_total",        "Bytes scanned.",                                     offsetof(struct scan_stats, bytes),        0 },
+    { "logwarn_rotations_total",    "Log file rotations handled.",                        offsetof(struct scan_stats, rotations),    0 },
+    { "logwarn_cache_hits_total",   "Log messages whose match verdict was cached.",       offsetof(struct scan_stats, cache_hits),   1 },
+    { "logwarn_cache_misses_total", "Log messages whose match verdict was not cached.",   offsetof(struct scan_stats, cache_misses), 1 },
+};
+#define NUM_METRICS     (sizeof(metrics) / sizeof(*metrics))
+
+// Internal functions
+static void write_metrics(FILE *fp, const struct logwarn_scanner *s, const char *logfile, const struct logwarn_state *state);
+static void write_labels(FILE *fp, const char *logfile, const struct logwarn_state *state);
+static void write_label_value(FILE *fp, const char *prefix, const char *value);
+static int  duplicate_pattern(const struct logwarn_patterns *patterns, unsigned int index);
+
+/*
+ * Write the cumulative counters in the given state in the Prometheus text format, e.g., for the
+ * node_exporter textfile collector. The file is replaced atomically, so it's never seen half written.
+ * Returns -1 (with errno set) on error.
+ */
+int
+logwarn_write_metrics(const struct logwarn_scanner *s, const char *metrics_file, const char *logfile, const struct logwarn_state *state)
+{
+    char *temp;
+    int errno_save;
+    FILE *fp;
+    int fd;
+
+    // Create temporary file in the same directory
+    if ((temp = malloc(strlen(metrics_file) + 8)) == NULL)
+        return -1;
+    sprintf(temp, "%s.XXXXXX", metrics_file);
+    if ((fd = mkstemp(temp)) == -1) {
+        errno_save = errno;
+        free(temp);
+        errno = errno_save;
+        return -1;
+    }
+    if (fchmod(fd, 0644) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+        errno_save = errno;
+        (void)close(fd);
+        goto fail;
+    }
+
+    // Write metrics and move the file into place
+    write_metrics(fp, s, logfile, state);
+    if (ferror(fp)) {
+        errno_save = errno;
+        (void)fclose(fp);
+        goto fail;
+    }
+    if (fclose(fp) == EOF || rename(temp, metrics_file) == -1) {
+        errno_save = errno;
+        goto fail;
+    }
+    free(temp);
+    return 0;
+
+fail:
+    (void)unlink(temp);
+    free(temp);
+    errno = errno_save;
+    return -1;
+}
+
+static void
+write_metrics(FILE *fp, const struct logwarn_scanner *s, const char *logfile, const struct logwarn_state *state)
+{
+    unsigned int i;
+    unsigned int j;
+
+    // Per-log file counters, for each rule set
+    for (i = 0; i < NUM_METRICS; i++) {
+        if (metrics[i].cache && s->options.cache_size == 0)
+            continue;
+        fprintf(fp, "# HELP %s %s\n", metrics[i].name, metrics[i].help);
+        fprintf(fp, "# TYPE %s counter\n", metrics[i].name);
+        for (j = 0; j < s->num_sets; j++) {
+            const struct logwarn_state *const set_state = j == 0 ? state : &state->sets[j - 1];
+
+            if (s->sets[j].patterns == NULL)
+                continue;
+            fprintf(fp, "%s", metrics[i].name);
+            write_labels(fp, logfile, set_state);
+            fprintf(fp, "} %llu\n", *(const unsigned long long *)((const char *)&set_state->stats + metrics[i].offset));
+        }
+    }
+    fprintf(fp, "# HELP %s %s\n", "logwarn_scan_seconds_total", "Time spent scanning.");
+    fprintf(fp, "# TYPE %s counter\n", "logwarn_scan_seconds_total");
+    for (j = 0; j < s->num_sets; j++) {
+        const struct logwarn_state *const set_state = j == 0 ? state : &state->sets[j - 1];
+
+        if (s->sets[j].patterns == NULL)
+            continue;
+        fprintf(fp, "%s", "logwarn_scan_seconds_total");
+        write_labels(fp, logfile, set_state);
+        fprintf(fp, "} %llu.%03u\n", set_state->stats.scan_msecs / 1000, (unsigned int)(set_state->stats.scan_msecs % 1000));
+    }
+
+    // Per-pattern counters
+    for (i = 0; i < 2; i++) {
+        const char *const name = i == 0 ? "logwarn_pattern_matches_total" : "logwarn_pattern_suppressed_total";
+
+        fprintf(fp, "# HELP %s %s\n", name, i == 0 ?
+          "Log messages decided by this pattern, i.e., the first pattern to match them." :
+          "Matches of this pattern suppressed by repeat limits.");
+        fprintf(fp, "# TYPE %s counter\n", name);
+        for (j = 0; j < s->num_sets; j++) {
+            const struct logwarn_patterns *const patterns = s->sets[j].patterns;
+            const struct logwarn_state *const set_state = j == 0 ? state : &state->sets[j - 1];
+            unsigned int k;
+
+            if (patterns == NULL)
+                continue;
+            for (k = 0; k < patterns->num_patterns && k < set_state->stats.num_patterns; k++) {
+                const struct repat *const pat = &patterns->patterns[k];
+                const struct pattern_stats *const pstats = &set_state->stats.patterns[k];
+
+                if (duplicate_pattern(patterns, k))
+                    continue;
+                fprintf(fp, "%s", name);
+                write_labels(fp, logfile, set_state);
+                write_label_value(fp, pat->negate ? ",pattern=\"!" : ",pattern=\"", pat->string);
+                fprintf(fp, "} %llu\n", i == 0 ? pstats->matches : pstats->suppressed);
+            }
+        }
+    }
+}
+
+/*
+ * Output the labels common to all series for a rule set, leaving the label set open for more.
+ */
+static void
+write_labels(FILE *fp, const char *logfile, const struct logwarn_state *state)
+{
+    write_label_value(fp, "{logfile=\"", logfile != NULL ? logfile : STDIN_LOGFILE_LABEL);
+    if (state->name != NULL)
+        write_label_value(fp, ",set=\"", state->name);
+}
+
+/*
+ * Output a label value, preceded by the given prefix, escaping it as required.
+ */
+static void
+write_label_value(FILE *fp, const char *prefix, const char *value)
+{
+    fputs(prefix, fp);
+    for (; *value != '\0'; value++) {
+        switch (*value) {
+        case '\\':
+            fputs("\\\\", fp);
+            break;
+        case '"':
+            fputs("\\\"", fp);
+            break;
+        case '\n':
+            fputs("\\n", fp);
+            break;
+        default:
+            putc(*value, fp);
+            break;
+        }
+    }
+    putc('"', fp);
+}
+
+/*
+ * Determine whether a pattern is the same as an earlier one, which would produce a duplicate series.
+ */
+static int
+duplicate_pattern(const struct logwarn_patterns *patterns, unsigned int index)
+{
+    const struct repat *const pat = &patterns->patterns[index];
+    unsigned int i;
+
+    for (i = 0; i < index; i++) {
+        const struct repat *const other = &patterns->patterns[i];
+
+        if (other->negate == pat->negate && strcmp(other->string, pat->string) == 0)
+            return 1;
+    }
+    return 0;
+}
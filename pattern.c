@@ -0,0 +1,189 @@
+/*
+ * Logwarn - Utility for finding interesting messages in log files
+ *
+ * Copyright (C) 2010-2011 Archie L. Cobbs. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logwarn.h"
+
+struct logwarn_patterns *
+logwarn_patterns_create(int default_match)
+{
+    struct logwarn_patterns *set;
+
+    if ((set = malloc(sizeof(*set))) == NULL)
+        return NULL;
+    memset(set, 0, sizeof(*set));
+    set->default_match = default_match;
+    return set;
+}
+
+/*
+ * Add a pattern to the end of the set. A leading `!' makes the pattern negative.
+ * Positive patterns join the most recently added repeat group, if any.
+ * The pattern is not compiled until logwarn_patterns_compile() is invoked.
+ */
+int
+logwarn_patterns_add(struct logwarn_patterns *set, const char *string, int flags)
+{
+    struct repat *pat;
+    struct repat *patterns;
+    const char *s;
+
+    // Make room
+    if ((patterns = realloc(set->patterns, (set->num_patterns + 1) * sizeof(*patterns))) == NULL) {
+        snprintf(set->error, sizeof(set->error), "%s: %s", "realloc", strerror(errno));
+        return -1;
+    }
+    set->patterns = patterns;
+    pat = &set->patterns[set->num_patterns];
+    memset(pat, 0, sizeof(*pat));
+    pat->repeat = -1;
+    for (s = string; *s != '\0'; s++)
+        pat->hash = pat->hash * 37 + (unsigned char)*s;
+
+    // Check for negation
+    if (*string == '!') {
+        string++;
+        pat->negate = 1;
+    }
+
+    // Add (positive) pattern to the current repeat, if any
+    if (!pat->negate && set->num_repeats > 0) {
+        set->repeats[set->num_repeats - 1].hash ^= pat->hash;
+        pat->repeat = set->num_repeats - 1;
+    }
+
+    // Record pattern
+    if ((pat->string = strdup(string)) == NULL) {
+        snprintf(set->error, sizeof(set->error), "%s: %s", "strdup", strerror(errno));
+        return -1;
+    }
+    pat->eflags = (flags & LOGWARN_ICASE) != 0 ? REG_ICASE : 0;
+    set->num_patterns++;
+    set->compiled = 0;
+    return 0;
+}
+
+/*
+ * Start a new repeat group to which subsequent positive patterns will belong.
+ */
+int
+logwarn_patterns_add_repeat(struct logwarn_patterns *set, unsigned int num, unsigned int secs)
+{
+    struct repeat *repeats;
+    struct repeat *repeat;
+
+    if (num == 0) {
+        snprintf(set->error, sizeof(set->error), "invalid zero repeat count in \"-T %u/%u\"", num, secs);
+        return -1;
+    }
+    if ((repeats = realloc(set->repeats, (set->num_repeats + 1) * sizeof(*repeats))) == NULL) {
+        snprintf(set->error, sizeof(set->error), "%s: %s", "realloc", strerror(errno));
+        return -1;
+    }
+    set->repeats = repeats;
+    repeat = &set->repeats[set->num_repeats++];
+    memset(repeat, 0, sizeof(*repeat));
+    repeat->num = num;
+    repeat->secs = secs;
+    return 0;
+}
+
+int
+logwarn_patterns_compile(struct logwarn_patterns *set)
+{
+    unsigned int i;
+
+    for (i = 0; i < set->num_patterns; i++) {
+        struct repat *const pat = &set->patterns[i];
+
+        if (!pat->compiled && logwarn_compile_pattern(pat, pat->string, pat->eflags, set->error, sizeof(set->error)) == -1)
+            return -1;
+    }
+    set->compiled = 1;
+    return 0;
+}
+
+const char *
+logwarn_patterns_error(const struct logwarn_patterns *set)
+{
+    return set->error;
+}
+
+/*
+ * Fold the pattern strings and flags of a pattern set, which may be NULL, into a running hash.
+ */
+unsigned int
+logwarn_patterns_hash(const struct logwarn_patterns *set, unsigned int hash)
+{
+    unsigned int i;
+
+    if (set == NULL)
+        return hash;
+    for (i = 0; i < set->num_patterns; i++)
+        hash = (hash * 37 + set->patterns[i].hash) * 37 + (unsigned int)set->patterns[i].eflags;
+    return hash;
+}
+
+void
+logwarn_patterns_free(struct logwarn_patterns *set)
+{
+    unsigned int i;
+
+    if (set == NULL)
+        return;
+    for (i = 0; i < set->num_patterns; i++) {
+        logwarn_free_pattern(&set->patterns[i]);
+        free(set->patterns[i].string);
+    }
+    free(set->patterns);
+    free(set->repeats);
+    free(set);
+}
+
+int
+logwarn_compile_pattern(struct repat *pat, const char *string, int eflags, char *errbuf, size_t errlen)
+{
+    char ebuf[ERROR_BUFFER_SIZE / 2];
+    int r;
+
+    if ((r = regcomp(&pat->regex, string, REG_EXTENDED|REG_NOSUB|REG_NEWLINE|eflags)) != 0) {
+        regerror(r, &pat->regex, ebuf, sizeof(ebuf));
+        snprintf(errbuf, errlen, "invalid regular expression \"%s\": %s", string, ebuf);
+        return -1;
+    }
+    pat->compiled = 1;
+    return 0;
+}
+
+void
+logwarn_free_pattern(struct repat *pat)
+{
+    if (pat->compiled) {
+        regfree(&pat->regex);
+        pat->compiled = 0;
+    }
+}
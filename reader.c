@@ -0,0 +1,364 @@
+/*
+ * Logwarn - Utility for finding interesting messages in log files
+ *
+ * Copyright (C) 2010-2011 Archie L. Cobbs. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logwarn.h"
+
+// Definitions
+#define READ_BLOCK_SIZE     (256 * 1024)
+#define READAHEAD_SIZE      (1024 * 1024)
+#define DIRECT_ALIGN        4096
+
+// Each split of an overly long line needs one extra byte for its NUL terminator
+#define SPLIT_SPARE(size)   ((size) / (MAX_LINE_LENGTH - 1) + 1)
+
+// Internal functions
+static int  reader_fill(struct reader *r);
+static void reader_drop_cache(struct reader *r);
+
+/*
+ * Initialize a reader. Returns -1 (with errno set) on error.
+ */
+int
+logwarn_reader_init(struct reader *r, int fd, const char *name, int flags)
+{
+    struct stat sb;
+    off_t off;
+    int error;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->keep = -1;
+    r->idle_msecs = -1;
+    r->name = name != NULL ? name : "(stdin)";
+    r->size = MAX_LINE_LENGTH + READ_BLOCK_SIZE;
+    if ((error = posix_memalign((void **)&r->buf, DIRECT_ALIGN, r->size + SPLIT_SPARE(r->size))) != 0) {
+        r->buf = NULL;
+        errno = error;
+        return -1;
+    }
+    if ((off = lseek(fd, 0, SEEK_CUR)) != -1)
+        r->readoff = r->consumed = r->dropped = off;
+
+    // Page cache options only apply to regular files
+    if (flags != 0 && (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)))
+        flags = 0;
+#ifdef O_DIRECT
+    if ((flags & READER_DIRECT) != 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == -1)
+        flags &= ~READER_DIRECT;
+#else
+    flags &= ~READER_DIRECT;
+#endif
+#if HAVE_POSIX_FADVISE
+    if ((flags & READER_NOCACHE) != 0)
+        (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    r->flags = flags;
+    return 0;
+}
+
+void
+logwarn_reader_free(struct reader *r)
+{
+    reader_drop_cache(r);
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/*
+ * Switch to streaming mode, in which reads don't wait indefinitely. Instead, if no input arrives within
+ * idle_msecs, logwarn_reader_getline() returns NULL with r->idle set, giving the caller a chance to catch up on
+ * other work; the caller must clear r->idle before continuing. The next read then waits for input indefinitely.
+ */
+void
+logwarn_reader_stream(struct reader *r, unsigned int idle_msecs)
+{
+    r->idle_msecs = idle_msecs;
+}
+
+/*
+ * Seek forward from the current position before reading anything.
+ * Returns -1 if the input is not seekable.
+ */
+int
+logwarn_reader_seek(struct reader *r, off_t pos)
+{
+    size_t discard = 0;
+    off_t off;
+
+    // Direct I/O requires aligned reads, so start at the preceding boundary
+    if ((r->flags & READER_DIRECT) != 0) {
+        discard = (size_t)(pos % DIRECT_ALIGN);
+        pos -= discard;
+    }
+    if ((off = lseek(r->fd, pos, SEEK_CUR)) == -1)
+        return -1;
+    r->readoff = off;
+    r->consumed = r->dropped = off + discard;
+    r->discard = discard;
+    return 0;
+}
+
+/*
+ * Convert between pointers to data returned by logwarn_reader_getline() and stable offsets.
+ */
+off_t
+logwarn_reader_offset(const struct reader *r, const char *ptr)
+{
+    return r->base + (ptr - r->buf);
+}
+
+const char *
+logwarn_reader_pointer(const struct reader *r, off_t offset)
+{
+    return r->buf + (offset - r->base);
+}
+
+/*
+ * Keep the data at and after the given offset (as returned by logwarn_reader_offset()) in the buffer,
+ * so that previously returned lines remain valid. An offset of -1 releases any retained data.
+ */
+void
+logwarn_reader_keep(struct reader *r, off_t offset)
+{
+    r->keep = offset;
+}
+
+/*
+ * Read the next line, or the next MAX_LINE_LENGTH - 1 bytes of it if it's too long.
+ * The line is NUL-terminated in place, with any newline omitted. The returned pointer
+ * remains valid until the next call. The number of bytes consumed (including the
+ * newline) is stored in *lenp. See also logwarn_reader_keep().
+ *
+ * Returns NULL at end of file, including when the last line is incomplete, or on error,
+ * in which case r->error is set. In streaming mode, also returns NULL if the input is idle.
+ */
+char *
+logwarn_reader_getline(struct reader *r, size_t *lenp)
+{
+    size_t avail;
+    char *line;
+    char *nl;
+
+    while (1) {
+        avail = r->end - r->start;
+        line = r->buf + r->start;
+
+        // Look for a complete line
+        if ((nl = memchr(line, '\n', avail < MAX_LINE_LENGTH - 1 ? avail : MAX_LINE_LENGTH - 1)) != NULL) {
+            *nl = '\0';
+            *lenp = nl - line + 1;
+            r->start += *lenp;
+            r->consumed += *lenp;
+            return line;
+        }
+
+        // Split overly long lines; shift the remainder over by one to make room for the NUL
+        if (avail >= MAX_LINE_LENGTH - 1) {
+            memmove(line + MAX_LINE_LENGTH, line + MAX_LINE_LENGTH - 1, avail - (MAX_LINE_LENGTH - 1));
+            line[MAX_LINE_LENGTH - 1] = '\0';
+            r->end++;
+            r->start += MAX_LINE_LENGTH;
+            *lenp = MAX_LINE_LENGTH - 1;
+            r->consumed += *lenp;
+            return line;
+        }
+
+        // Need more data
+        if (r->eof || !reader_fill(r))
+            return NULL;
+    }
+}
+
+/*
+ * Skip over the given number of newline-terminated lines.
+ * Used when the input is not seekable.
+ */
+void
+logwarn_reader_skip_lines(struct reader *r, unsigned long count)
+{
+    char *nl;
+
+    while (count > 0) {
+        if ((nl = memchr(r->buf + r->start, '\n', r->end - r->start)) != NULL) {
+            r->consumed += nl - (r->buf + r->start) + 1;
+            r->start = nl - r->buf + 1;
+            count--;
+            continue;
+        }
+        r->consumed += r->end - r->start;
+        r->start = r->end;
+        if (r->eof || !reader_fill(r)) {
+            if (!r->idle)
+                break;
+            r->idle = 0;
+        }
+    }
+}
+
+/*
+ * Read another block of data into the buffer.
+ * Returns zero at end of file or on error.
+ */
+static int
+reader_fill(struct reader *r)
+{
+    char tail[DIRECT_ALIGN];
+    size_t from = r->start;
+    size_t partial = 0;
+    size_t remain;
+    size_t pad = 0;
+    size_t space;
+    ssize_t nread;
+    int error;
+
+    // Determine how much data we must retain
+    if (r->keep != -1 && r->keep - r->base < (off_t)from)
+        from = r->keep - r->base;
+    remain = r->end - from;
+
+    // Discard consumed data; for direct I/O, align the remaining data the same way in memory as in the file
+    if ((r->flags & READER_DIRECT) != 0) {
+        partial = (size_t)(r->readoff % DIRECT_ALIGN);
+        pad = (DIRECT_ALIGN + partial - remain % DIRECT_ALIGN) % DIRECT_ALIGN;
+    }
+    if (pad + remain + READ_BLOCK_SIZE / 2 > r->size) {             // retained data is crowding the buffer, so grow it
+        const size_t new_size = pad + remain + MAX_LINE_LENGTH + READ_BLOCK_SIZE;
+        char *new_buf;
+
+        if ((error = posix_memalign((void **)&new_buf, DIRECT_ALIGN, new_size + SPLIT_SPARE(new_size))) != 0) {
+            r->error = error;
+            return 0;
+        }
+        memcpy(new_buf + pad, r->buf + from, remain);
+        free(r->buf);
+        r->buf = new_buf;
+        r->size = new_size;
+    } else if (from != pad)
+        memmove(r->buf + pad, r->buf + from, remain);
+    r->base += (off_t)from - (off_t)pad;
+    r->start = r->start - from + pad;
+    r->end = pad + remain;
+
+    // In streaming mode, wait for more input, but not so long that we don't notice it's idle
+    if (r->idle_msecs != -1 && !r->waiting) {
+        struct pollfd pfd;
+        int ready;
+
+        pfd.fd = r->fd;
+        pfd.events = POLLIN;
+        while ((ready = poll(&pfd, 1, r->idle_msecs)) == -1) {
+            if (errno != EINTR) {
+                r->error = errno;
+                return 0;
+            }
+        }
+        if (ready == 0) {
+            r->idle = 1;
+            r->waiting = 1;
+            return 0;
+        }
+    }
+
+    // After a short read, direct I/O must back up to the preceding boundary and read the partial block again;
+    // the copy of it already in the buffer may have been modified, so it is set aside and put back afterward
+    if (partial > 0) {
+        if (lseek(r->fd, r->readoff - partial, SEEK_SET) == -1) {
+            r->error = errno;
+            return 0;
+        }
+        memcpy(tail, r->buf + r->end - partial, partial);
+    }
+
+    // Read more data
+    space = r->size - r->end + partial;
+    if ((r->flags & READER_DIRECT) != 0)
+        space -= space % DIRECT_ALIGN;
+    while ((nread = read(r->fd, r->buf + r->end - partial, space)) == -1) {
+#ifdef O_DIRECT
+        if (errno == EINVAL && (r->flags & READER_DIRECT) != 0 && r->reads == 0) {     // not supported by filesystem
+            (void)fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL) & ~O_DIRECT);
+            r->flags &= ~READER_DIRECT;
+            continue;
+        }
+#endif
+        if (errno != EINTR) {
+            r->error = errno;
+            return 0;
+        }
+    }
+    if (partial > 0) {
+        memcpy(r->buf + r->end - partial, tail, partial);
+        nread = nread > (ssize_t)partial ? nread - (ssize_t)partial : 0;
+    }
+    r->readoff += nread;
+    r->waiting = 0;
+    r->end += nread;
+    r->reads++;
+
+    // Skip leading data before an unaligned starting position
+    if (r->discard > 0) {
+        const size_t skip = r->discard < r->end - r->start ? r->discard : r->end - r->start;
+
+        r->start += skip;
+        r->discard -= skip;
+    }
+
+    // Release consumed data from the page cache and request the next chunk
+    if ((r->flags & READER_NOCACHE) != 0) {
+        reader_drop_cache(r);
+#if HAVE_POSIX_FADVISE
+        (void)posix_fadvise(r->fd, r->readoff, READAHEAD_SIZE, POSIX_FADV_WILLNEED);
+#endif
+    }
+
+    // Check for EOF
+    if (nread == 0) {
+        r->eof = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Advise the kernel that we won't need the full pages we've already consumed.
+ */
+static void
+reader_drop_cache(struct reader *r)
+{
+#if HAVE_POSIX_FADVISE
+    const off_t upto = r->consumed - r->consumed % DIRECT_ALIGN;
+
+    if ((r->flags & READER_NOCACHE) == 0 || upto <= r->dropped)
+        return;
+    (void)posix_fadvise(r->fd, r->dropped, upto - r->dropped, POSIX_FADV_DONTNEED);
+    r->dropped = upto;
+#endif
+}
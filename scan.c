@@ -0,0 +1,1701 @@
+/*
+ * Logwarn - Utility for finding interesting messages in log files
+ *
+ * Copyright (C) 2010-2011 Archie L. Cobbs. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logwarn.h"
+
+// Scanner features in use (s->features), so per-line work for any other feature is skipped after testing its bit
+#define SCAN_MULTILINE          0x01        // -m
+#define SCAN_REPEAT             0x02        // -T
+#define SCAN_CONTEXT            0x04        // -A or -B
+#define SCAN_LIMITS             0x08        // -N, -b, -t, -s, or -u
+
+// Pipe buffer size for reading from a decompressor, so that it can run further ahead of us
+#define PIPE_BUFFER_SIZE        (1024 * 1024)
+
+// Adaptive pattern ordering: how often to time a pattern evaluation, and how often to update the order
+#define SAMPLE_INTERVAL         16          // must be a power of two
+#define REORDER_INTERVAL        (64 * 1024)
+
+// Binary search for a time range stops once it has narrowed the range down to this size
+#define PROBE_SIZE              (64 * 1024)
+
+// Year value meaning "not set by strptime()"
+#define NO_YEAR                 (-1)
+
+// Internal functions
+static int  init_set(struct logwarn_scanner *s, struct scan_set *set,
+                struct logwarn_patterns *patterns, const struct logwarn_set_options *options);
+static int  order_patterns(struct logwarn_scanner *s, struct scan_set *set);
+static void sort_patterns(struct scan_set *set);
+static unsigned int run_end(const struct logwarn_patterns *patterns, unsigned int start);
+static int  scan_file(struct logwarn_scanner *s, const char *logfile, int rotated);
+static int  start_decompressor(const char *cmd, const char *logfile, pid_t *pidp);
+static int  scan_lines(struct logwarn_scanner *s, struct reader *r, unsigned long lnum);
+static int  seek_time_range(struct logwarn_scanner *s, int fd, const char *logfile, struct logwarn_state *start);
+static off_t find_time(struct logwarn_scanner *s, int fd, char *buf, off_t lo, off_t hi, time_t when);
+static int  entry_time(struct logwarn_scanner *s, const char *line, time_t *whenp);
+static const char *parse_time(const char *format, const char *string, time_t now, time_t *tp);
+static int  probe_entry(struct logwarn_scanner *s, int fd, char *buf, off_t off, off_t *offp, time_t *whenp);
+static char *find_rotated(struct logwarn_scanner *s, const char *logfile);
+static void output_line(struct logwarn_scanner *s, struct scan_set *set, int type, unsigned long lnum, const char *line);
+static void flush_output(struct scan_set *set);
+static int  input_idle(struct logwarn_scanner *s, struct reader *r);
+static int  add_message_line(struct logwarn_scanner *s, struct reader *r, const char *line, size_t len,
+                unsigned long lnum, unsigned char continuation);
+static int  finish_message(struct logwarn_scanner *s, struct reader *r);
+static int  hold_message(struct logwarn_scanner *s, struct reader *r);
+static int  scan_message(struct logwarn_scanner *s, struct scan_set *set, struct reader *r, char *text);
+static void join_lines(const struct logwarn_scanner *s, char *text, unsigned int from, unsigned int to, char sep);
+static void push_before_context(struct logwarn_scanner *s, struct scan_set *set,
+                struct reader *r, const char *line, unsigned long lnum);
+static void flush_before_context(struct logwarn_scanner *s, struct scan_set *set, struct reader *r);
+static void discard_before_context(struct logwarn_scanner *s, struct scan_set *set, struct reader *r);
+static void update_keep(struct logwarn_scanner *s, struct reader *r);
+
+void
+logwarn_options_init(struct logwarn_options *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->rotated_pattern = DEFAULT_ROTPAT;
+    options->max_errors_processed = UINT_MAX;
+    options->max_errors_output = UINT_MAX;
+    options->max_lines_output = UINT_MAX;
+}
+
+void
+logwarn_set_options_init(struct logwarn_set_options *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->max_errors_processed = UINT_MAX;
+    options->max_errors_output = UINT_MAX;
+}
+
+/*
+ * Create a scanner using the given pattern set, which must remain valid for the life of the scanner.
+ * The pattern set may be NULL if only additional rule sets will be used.
+ * Returns NULL on error, in which case an error message is written into errbuf.
+ */
+struct logwarn_scanner *
+logwarn_scanner_create(struct logwarn_patterns *set, const struct logwarn_options *options, char *errbuf, size_t errlen)
+{
+    struct logwarn_set_options set_options;
+    struct logwarn_scanner *s;
+    const int eflags = (options->pattern_flags & LOGWARN_ICASE) != 0 ? REG_ICASE : 0;
+
+    // Allocate scanner
+    if ((s = malloc(sizeof(*s))) == NULL) {
+        snprintf(errbuf, errlen, "%s: %s", "malloc", strerror(errno));
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    s->options = *options;
+    s->msg_offset = -1;
+
+    // A time range requires timestamps
+    if ((options->since != 0 || options->until != 0) && options->time_format == NULL) {
+        snprintf(errbuf, errlen, "a time range requires a timestamp format");
+        goto fail;
+    }
+
+    // Compile first line and rotated file patterns
+    if (options->multiline_pattern != NULL
+      && logwarn_compile_pattern(&s->log_pattern, options->multiline_pattern, eflags, errbuf, errlen) == -1)
+        goto fail;
+    if (logwarn_compile_pattern(&s->rot_pattern, options->rotated_pattern, 0, errbuf, errlen) == -1)
+        goto fail;
+
+    // Add the first rule set
+    set_options.max_errors_processed = options->max_errors_processed;
+    set_options.max_errors_output = options->max_errors_output;
+    set_options.output = options->output;
+    set_options.output_arg = options->output_arg;
+    if (logwarn_scanner_add_set(s, set, &set_options) == -1) {
+        snprintf(errbuf, errlen, "%s", s->error);
+        goto fail;
+    }
+    return s;
+
+fail:
+    logwarn_scanner_free(s);
+    return NULL;
+}
+
+/*
+ * Add a rule set to be evaluated in the same pass as the scanner's other rule sets.
+ * Returns the index of the new rule set, or -1 on error.
+ */
+int
+logwarn_scanner_add_set(struct logwarn_scanner *s, struct logwarn_patterns *set, const struct logwarn_set_options *options)
+{
+    struct scan_set *sets;
+
+    if ((sets = realloc(s->sets, (s->num_sets + 1) * sizeof(*sets))) == NULL) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", "realloc", strerror(errno));
+        return -1;
+    }
+    s->sets = sets;
+    if (init_set(s, &s->sets[s->num_sets], set, options) == -1)
+        return -1;
+    return s->num_sets++;
+}
+
+static int
+init_set(struct logwarn_scanner *s, struct scan_set *set,
+    struct logwarn_patterns *patterns, const struct logwarn_set_options *options)
+{
+    memset(set, 0, sizeof(*set));
+    set->patterns = patterns;
+    set->options = *options;
+    if (s->options.before_context > 0
+      && (set->before_lines = malloc(s->options.before_context * sizeof(*set->before_lines))) == NULL) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", "malloc", strerror(errno));
+        return -1;
+    }
+
+    // Create match verdict cache, with the number of entries rounded up to a power of two
+    if (s->options.cache_size > 0 && patterns != NULL) {
+        unsigned int size;
+
+        for (size = 1; size < s->options.cache_size && size < (1U << 31); size <<= 1)
+            ;
+        if ((set->cache = calloc(size, sizeof(*set->cache))) == NULL) {
+            snprintf(s->error, sizeof(s->error), "%s: %s", "calloc", strerror(errno));
+            free(set->before_lines);
+            return -1;
+        }
+        set->cache_mask = size - 1;
+    }
+    return 0;
+}
+
+void
+logwarn_scanner_free(struct logwarn_scanner *s)
+{
+    unsigned int i;
+
+    if (s == NULL)
+        return;
+    logwarn_free_pattern(&s->log_pattern);
+    logwarn_free_pattern(&s->rot_pattern);
+    for (i = 0; i < s->num_sets; i++) {
+        struct scan_set *const set = &s->sets[i];
+
+        free(set->before_lines);
+        free(set->order);
+        if (set->cache != NULL) {
+            unsigned int j;
+
+            for (j = 0; j <= set->cache_mask; j++)
+                free(set->cache[j].line);
+            free(set->cache);
+        }
+    }
+    free(s->sets);
+    free(s->msg_lines);
+    free(s);
+}
+
+const char *
+logwarn_scanner_error(const struct logwarn_scanner *s)
+{
+    return s->error;
+}
+
+/*
+ * Determine whether the given rule set found any matches during the most recent scan.
+ */
+int
+logwarn_scanner_matched(const struct logwarn_scanner *s, unsigned int index)
+{
+    return index < s->num_sets && s->sets[index].any_matches;
+}
+
+/*
+ * Scan a log file, or standard input if logfile is NULL, picking up where the given state left off.
+ * If the log file has been rotated since, the rotated file is scanned first. The state is updated
+ * in place but not saved. The log is read once no matter how many rule sets there are.
+ *
+ * Returns a combination of LOGWARN_MATCHED and LOGWARN_PARTIAL, or -1 on error.
+ */
+int
+logwarn_scan(struct logwarn_scanner *s, const char *logfile, struct logwarn_state *state)
+{
+    int features = 0;
+    int any_matches = 0;
+    int any_active = 0;
+    struct timespec end_time;
+    struct stat sb;
+    unsigned int i;
+
+    // Check rule sets against state
+    if (state->num_sets != s->num_sets - 1) {
+        snprintf(s->error, sizeof(s->error), "scan state has %u additional rule set(s) but scanner has %u",
+          state->num_sets, s->num_sets - 1);
+        return -1;
+    }
+
+    // Reset per-scan counters and bind each rule set to its state
+    clock_gettime(CLOCK_MONOTONIC, &s->start_time);
+    time(&s->now);
+    s->stamp_len = 0;
+    s->bytes_scanned = 0;
+    s->out_of_time = 0;
+    s->budget_exhausted = 0;
+    *s->error = '\0';
+    for (i = 0; i < s->num_sets; i++) {
+        struct scan_set *const set = &s->sets[i];
+
+        set->state = i == 0 ? state : &state->sets[i - 1];
+        set->error_count = 0;
+        set->line_count = 0;
+        set->active = 0;
+        set->stopped = 0;
+        set->any_matches = 0;
+        set->any_output = 0;
+        set->context_gap = 0;
+        if (set->patterns != NULL && set->state->stats.num_patterns != set->patterns->num_patterns) {
+            snprintf(s->error, sizeof(s->error), "scan state has %u pattern(s) but rule set has %u",
+              set->state->stats.num_patterns, set->patterns->num_patterns);
+            return -1;
+        }
+        if (set->patterns != NULL && order_patterns(s, set) == -1)
+            return -1;
+
+        // Note which features we need
+        if (set->patterns != NULL && set->patterns->num_repeats > 0)
+            features |= SCAN_REPEAT;
+        if (set->options.max_errors_processed != UINT_MAX)
+            features |= SCAN_LIMITS;
+    }
+
+    // Note which scanner-wide features we need
+    if (s->options.multiline_pattern != NULL)
+        features |= SCAN_MULTILINE;
+    if (s->options.before_context > 0 || s->options.after_context > 0)
+        features |= SCAN_CONTEXT;
+    if (s->options.max_bytes != 0 || s->options.max_seconds != 0 || s->options.since != 0 || s->options.until != 0)
+        features |= SCAN_LIMITS;
+    s->features = features;
+
+    // Get log file info
+    if (logfile != NULL && stat(logfile, &sb) == -1) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", logfile, strerror(errno));
+        return -1;
+    }
+
+    // Has log file rotated since we last checked? If so, scan the rotated file first,
+    // assuming it's the previous version, for those rule sets that have not seen it yet.
+    if (logfile != NULL) {
+        for (i = 0; i < s->num_sets; i++) {
+            struct scan_set *const set = &s->sets[i];
+
+            set->active = set->patterns != NULL && set->state->inode != sb.st_ino;
+            any_active |= set->active;
+        }
+        if (any_active) {
+            struct stat rsb;
+            char *rotated;
+
+            if ((rotated = find_rotated(s, logfile)) == NULL && *s->error != '\0')
+                return -1;
+
+            // Skip the rotated file if it was last written before the start of the time range
+            if (rotated != NULL && s->options.since != 0
+              && stat(rotated, &rsb) == 0 && rsb.st_mtime < s->options.since) {
+                free(rotated);
+                rotated = NULL;
+            }
+            if (rotated != NULL) {
+                const int r = scan_file(s, rotated, 1);
+
+                free(rotated);
+                if (r == -1)
+                    return -1;
+            }
+
+            // Update state for new file, unless we stopped early and must resume in the rotated file next time
+            for (i = 0; i < s->num_sets; i++) {
+                struct scan_set *const set = &s->sets[i];
+
+                if (set->active && !set->stopped && !s->budget_exhausted) {
+                    if (set->state->inode != 0)
+                        set->state->stats.rotations++;
+                    set->state->inode = sb.st_ino;
+                    set->state->line = 1;
+                    set->state->pos = 0;
+                }
+            }
+
+            // Any log message held back at the end of the old file has now been finished
+            state->held_pos = 0;
+            state->held_end = 0;
+        }
+    }
+
+    // Now scan the logfile itself, unless we ran out of budget
+    if (!s->budget_exhausted) {
+        any_active = 0;
+        for (i = 0; i < s->num_sets; i++) {
+            struct scan_set *const set = &s->sets[i];
+            struct logwarn_state *const set_state = set->state;
+
+            set->active = set->patterns != NULL && !set->stopped;
+            any_active |= set->active;
+
+            // Check whether the file has been truncated in place
+            if (set->active && logfile != NULL && set_state->pos > (long)sb.st_size) {
+                set_state->line = 1;
+                set_state->pos = 0;
+                set_state->matching = 0;
+                set_state->after = 0;
+            }
+        }
+        if (any_active && scan_file(s, logfile, 0) == -1)
+            return -1;
+    }
+
+    // Done
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    for (i = 0; i < s->num_sets; i++) {
+        struct scan_set *const set = &s->sets[i];
+
+        if (set->patterns != NULL) {
+            set->state->stats.scan_msecs += (end_time.tv_sec - s->start_time.tv_sec) * 1000
+              + (end_time.tv_nsec - s->start_time.tv_nsec) / 1000000;
+        }
+        any_matches |= set->any_matches;
+    }
+    return (any_matches ? LOGWARN_MATCHED : 0) | (s->budget_exhausted ? LOGWARN_PARTIAL : 0);
+}
+
+/*
+ * Set up the order in which a rule set's patterns are evaluated. Within a run of consecutive patterns
+ * having the same polarity and no `-T' repeat group, the first pattern to match gives the same result
+ * no matter which one it is, so each such run is evaluated in the order most likely to reach a match
+ * quickly, according to the statistics kept in the scan state. Returns -1 on error.
+ */
+static int
+order_patterns(struct logwarn_scanner *s, struct scan_set *set)
+{
+    const struct logwarn_patterns *const patterns = set->patterns;
+    unsigned int i;
+
+    // If there are no runs of two or more patterns, use the declared order
+    for (i = 0; i < patterns->num_patterns && run_end(patterns, i) == i + 1; i++)
+        ;
+    if (i == patterns->num_patterns) {
+        free(set->order);
+        set->order = NULL;
+        set->num_order = 0;
+        return 0;
+    }
+
+    // Allocate order array
+    if (set->num_order != patterns->num_patterns) {
+        unsigned int *const order = realloc(set->order, patterns->num_patterns * sizeof(*set->order));
+
+        if (order == NULL) {
+            snprintf(s->error, sizeof(s->error), "%s: %s", "realloc", strerror(errno));
+            return -1;
+        }
+        set->order = order;
+        set->num_order = patterns->num_patterns;
+    }
+    sort_patterns(set);
+    return 0;
+}
+
+/*
+ * Sort each run of interchangeable patterns by matches per unit of evaluation time, which minimizes the
+ * expected time to find the first match. Patterns not yet timed go first (so they get timed), and ties
+ * keep the declared order.
+ */
+static void
+sort_patterns(struct scan_set *set)
+{
+    const struct pattern_stats *const pstats = set->state->stats.patterns;
+    unsigned int start;
+    unsigned int end;
+    unsigned int i;
+    unsigned int j;
+
+    for (start = 0; start < set->num_order; start = end) {
+        end = run_end(set->patterns, start);
+        for (i = start; i < end; i++)
+            set->order[i] = i;
+        for (i = start + 1; i < end; i++) {
+            const unsigned int index = set->order[i];
+            const struct pattern_stats *const ps = &pstats[index];
+
+            for (j = i; j > start; j--) {
+                const struct pattern_stats *const prev = &pstats[set->order[j - 1]];
+
+                if (prev->nsecs == 0
+                  || (ps->nsecs != 0 && (double)ps->matches * prev->nsecs <= (double)prev->matches * ps->nsecs))
+                    break;
+                set->order[j] = set->order[j - 1];
+            }
+            set->order[j] = index;
+        }
+    }
+    set->since_reorder = 0;
+}
+
+/*
+ * Find the end of the run of interchangeable patterns starting at the given index.
+ */
+static unsigned int
+run_end(const struct logwarn_patterns *patterns, unsigned int start)
+{
+    const struct repat *const first = &patterns->patterns[start];
+    unsigned int end;
+
+    if (first->repeat != -1)
+        return start + 1;
+    for (end = start + 1; end < patterns->num_patterns; end++) {
+        const struct repat *const pat = &patterns->patterns[end];
+
+        if (pat->negate != first->negate || pat->repeat != -1)
+            break;
+    }
+    return end;
+}
+
+/*
+ * Find the rotated version of the given log file in the same directory.
+ * Returns NULL if not found, or on error, in which case s->error is set.
+ */
+static char *
+find_rotated(struct logwarn_scanner *s, const char *logfile)
+{
+    char *rotated = NULL;
+    char *result = NULL;
+    char *dname = NULL;
+    char *bname = NULL;
+    char *temp;
+    DIR *dir;
+
+    // Get directory and filename of file containing logfile
+    if ((temp = strdup(logfile)) == NULL || (bname = strdup(basename(temp))) == NULL) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", "strdup", strerror(errno));
+        goto done;
+    }
+    free(temp);
+    if ((temp = strdup(logfile)) == NULL || (dname = strdup(dirname(temp))) == NULL) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", "strdup", strerror(errno));
+        goto done;
+    }
+
+    // Search for rotated version in same directory
+    if ((dir = opendir(dname)) != NULL) {
+        const size_t bnamelen = strlen(bname);
+        struct dirent *ent;
+
+        for (ent = readdir(dir); ent != NULL; ent = readdir(dir)) {
+            int prefer;
+            int diff;
+
+            // Rotated file must have logfile name as prefix
+            if (strncmp(ent->d_name, bname, bnamelen) != 0)
+                continue;
+
+            // Skip the file itself
+            if (ent->d_name[bnamelen] == '\0')
+                continue;
+
+            // Compare rotated file against pattern
+            if (regexec(&s->rot_pattern.regex, ent->d_name + bnamelen, 0, NULL, 0) != 0)
+                continue;
+
+            // It's a candidate. Pick the first (or last) one in sorting order.
+            if (rotated == NULL)
+                prefer = 1;
+            else {
+                diff = strcmp(ent->d_name, rotated);
+                prefer = s->options.match_last_rotated ? diff > 0 : diff < 0;
+            }
+            if (prefer) {
+                char *const previous = rotated;
+
+                if ((rotated = realloc(rotated, strlen(ent->d_name) + 1)) == NULL) {
+                    snprintf(s->error, sizeof(s->error), "%s: %s", "realloc", strerror(errno));
+                    free(previous);
+                    closedir(dir);
+                    goto done;
+                }
+                strcpy(rotated, ent->d_name);
+            }
+        }
+        closedir(dir);
+    }
+
+    // Build full pathname
+    if (rotated != NULL) {
+        if ((result = malloc(strlen(dname) + 1 + strlen(rotated) + 1)) == NULL)
+            snprintf(s->error, sizeof(s->error), "%s: %s", "malloc", strerror(errno));
+        else
+            sprintf(result, "%s/%s", dname, rotated);
+    }
+
+done:
+    // Clean up
+    free(temp);
+    free(dname);
+    free(bname);
+    free(rotated);
+    return result;
+}
+
+/*
+ * Scan a log file for the active rule sets, each starting from its own state.
+ * Returns -1 on error.
+ */
+static int
+scan_file(struct logwarn_scanner *s, const char *logfile, int rotated)
+{
+    struct logwarn_state *start = NULL;
+    const char *cmd = NULL;
+    struct reader reader;
+    pid_t pid = -1;
+    unsigned int i;
+    int status = 0;
+    int result;
+    int fd;
+
+    // Open file
+    if (logfile == NULL)
+        fd = STDIN_FILENO;
+    else if ((fd = open(logfile, O_RDONLY | O_CLOEXEC)) == -1) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", logfile, strerror(errno));
+        return -1;
+    }
+
+    // Check for compressed file and if so decode gzip/xz/bzip2 on the fly
+    if (logfile != NULL) {
+        unsigned char magic[6];
+        ssize_t r;
+
+        if ((r = read(fd, magic, sizeof(magic))) == sizeof(magic)) {
+            if (magic[0] == 0x1f && magic[1] == 0x8b)
+                cmd = "gunzip";
+            else if (magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h')
+                cmd = "bunzip2";
+            else if (magic[0] == 0xfd && magic[1] == 0x37 && magic[2] == 0x7a
+              && magic[3] == 0x58 && magic[4] == 0x5a && magic[5] == 0x00)
+                cmd = "unxz";
+            if (cmd != NULL) {
+                (void)close(fd);
+                if ((fd = start_decompressor(cmd, logfile, &pid)) == -1) {
+                    snprintf(s->error, sizeof(s->error), "%s: can't invoke decompressor: %s", logfile, strerror(errno));
+                    return -1;
+                }
+            }
+        } else if (r == -1) {
+            snprintf(s->error, sizeof(s->error), "%s: %s", logfile, strerror(errno));
+            (void)close(fd);
+            return -1;
+        }
+    }
+
+    // Rewind to the beginning
+    if (logfile != NULL && cmd == NULL && lseek(fd, 0, SEEK_SET) == -1) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", logfile, strerror(errno));
+        (void)close(fd);
+        return -1;
+    }
+
+    // Set up reader
+    if (logwarn_reader_init(&reader, fd, logfile, s->options.io_flags) == -1) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", "malloc", strerror(errno));
+        result = -1;
+        goto done;
+    }
+    if (logfile == NULL && s->options.stream)
+        logwarn_reader_stream(&reader, s->options.idle_msecs);
+
+    // Before context does not span files, and after context is only pending if enabled
+    s->num_running = 0;
+    for (i = 0; i < s->num_sets; i++) {
+        struct scan_set *const set = &s->sets[i];
+
+        set->before_start = 0;
+        set->before_count = 0;
+        if (!set->active)
+            continue;
+        if (s->options.after_context == 0)
+            set->state->after = 0;
+        if (start == NULL || set->state->line < start->line)
+            start = set->state;
+        s->num_running++;
+    }
+
+    // Jump ahead to the time range, if any
+    s->skipping = s->options.since != 0;
+    s->until_offset = 0;
+    if ((s->options.since != 0 || s->options.until != 0) && logfile != NULL && cmd == NULL
+      && seek_time_range(s, fd, logfile, start) == -1) {
+        result = -1;
+        goto cleanup;
+    }
+
+    // Skip past lines already scanned by every rule set
+    if (start->pos != 0 && logwarn_reader_seek(&reader, start->pos) == -1)
+        logwarn_reader_skip_lines(&reader, start->line - 1);
+
+    // Scan lines; log messages being assembled don't span files, but one at the end of a log file that
+    // may still be written to can be left for the next invocation to finish (see hold_message())
+    s->msg_offset = -1;
+    s->msg_hold = logfile != NULL && cmd == NULL && !rotated;
+    result = scan_lines(s, &reader, start->line);
+
+    // Check for read error
+    if (result != -1 && reader.error != 0) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", logfile != NULL ? logfile : "(stdin)", strerror(reader.error));
+        result = -1;
+    }
+
+cleanup:
+    // Free buffer
+    logwarn_reader_free(&reader);
+
+done:
+    // Close file
+    if (cmd != NULL) {
+        (void)close(fd);
+        while (waitpid(pid, &status, 0) == -1) {
+            if (errno != EINTR) {
+                if (result != -1) {
+                    snprintf(s->error, sizeof(s->error), "%s: %s: %s", "waitpid", logfile, strerror(errno));
+                    result = -1;
+                }
+                break;
+            }
+        }
+        if (result != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+            snprintf(s->error, sizeof(s->error), "%s: can't invoke decompressor `%s'", logfile, cmd);
+            result = -1;
+        }
+    } else {
+        if (logfile != NULL && close(fd) == -1 && result != -1) {
+            snprintf(s->error, sizeof(s->error), "%s: %s: %s", "close", logfile, strerror(errno));
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/*
+ * Start a decompressor writing the contents of the given file to a pipe, and return the read end of the pipe.
+ * The file name is passed directly as an argument, never through a shell. Neither end of the pipe leaks into
+ * any other child process of the caller. Returns -1 (with errno set) on error.
+ */
+static int
+start_decompressor(const char *cmd, const char *logfile, pid_t *pidp)
+{
+    int errno_save;
+    int fds[2];
+
+#if HAVE_PIPE2
+    if (pipe2(fds, O_CLOEXEC) == -1)
+        return -1;
+#else
+    if (pipe(fds) == -1)
+        return -1;
+    (void)fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    (void)fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+#ifdef F_SETPIPE_SZ
+    (void)fcntl(fds[0], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+    switch ((*pidp = fork())) {
+    case -1:
+        errno_save = errno;
+        (void)close(fds[0]);
+        (void)close(fds[1]);
+        errno = errno_save;
+        return -1;
+    case 0:
+        (void)close(fds[0]);
+        if (fds[1] != STDOUT_FILENO) {
+            (void)dup2(fds[1], STDOUT_FILENO);
+            (void)close(fds[1]);
+        } else
+            (void)fcntl(STDOUT_FILENO, F_SETFD, 0);
+        execlp(cmd, cmd, "-c", "--", logfile, (char *)NULL);
+        _exit(127);
+    default:
+        break;
+    }
+    (void)close(fds[1]);
+    return fds[0];
+}
+
+/*
+ * Use binary search to find where the time range starts and ends in a regular file, so that
+ * only the lines in between need to be scanned. Log messages are assumed to be in time order.
+ * This is only done when every active rule set is starting from the same position.
+ * Returns -1 on error.
+ */
+static int
+seek_time_range(struct logwarn_scanner *s, int fd, const char *logfile, struct logwarn_state *start)
+{
+    unsigned long count = 0;
+    struct stat sb;
+    unsigned int i;
+    char *buf;
+    off_t pos;
+    off_t off;
+
+    // Check that every active rule set is starting from the same position
+    for (i = 0; i < s->num_sets; i++) {
+        const struct scan_set *const set = &s->sets[i];
+
+        if (set->active && set->state->pos != start->pos)
+            return 0;
+    }
+    if (fstat(fd, &sb) == -1) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", logfile, strerror(errno));
+        return -1;
+    }
+    if (!S_ISREG(sb.st_mode) || sb.st_size - start->pos <= PROBE_SIZE)
+        return 0;
+    if ((buf = malloc(PROBE_SIZE + 1)) == NULL) {
+        snprintf(s->error, sizeof(s->error), "%s: %s", "malloc", strerror(errno));
+        return -1;
+    }
+
+    // Find the offset beyond which we must check for the end of the time range
+    if (s->options.until != 0
+      && (s->until_offset = find_time(s, fd, buf, start->pos, sb.st_size, s->options.until)) == -1)
+        goto fail;
+
+    // Find where the time range starts
+    if (s->options.since == 0
+      || (pos = find_time(s, fd, buf, start->pos, sb.st_size, s->options.since)) == start->pos) {
+        free(buf);
+        return 0;
+    }
+    if (pos == -1)
+        goto fail;
+
+    // Count the lines we're skipping so line numbers stay correct
+    for (off = start->pos; off < pos; ) {
+        const size_t want = pos - off < PROBE_SIZE ? (size_t)(pos - off) : PROBE_SIZE;
+        const char *p = buf;
+        const char *end;
+        ssize_t r;
+
+        if ((r = pread(fd, buf, want, off)) == -1) {
+            if (errno == EINTR)
+                continue;
+            snprintf(s->error, sizeof(s->error), "%s: %s", logfile, strerror(errno));
+            goto fail;
+        }
+        if (r == 0)
+            break;
+        for (end = buf + r; (p = memchr(p, '\n', end - p)) != NULL; p++)
+            count++;
+        off += r;
+    }
+    free(buf);
+
+    // Advance the active rule sets; the new position is always the start of a log message
+    for (i = 0; i < s->num_sets; i++) {
+        struct logwarn_state *const state = s->sets[i].state;
+
+        if (!s->sets[i].active)
+            continue;
+        state->line += count;
+        state->pos = pos;
+        state->matching = 0;
+        state->after = 0;
+    }
+    return 0;
+
+fail:
+    free(buf);
+    return -1;
+}
+
+/*
+ * Binary search the range [lo, hi) for the first log message timestamped at or after `when'.
+ * Returns an offset (at lo or the start of a log message) before which every log message is
+ * older, which may be somewhat before the message sought. Returns -1 on error.
+ */
+static off_t
+find_time(struct logwarn_scanner *s, int fd, char *buf, off_t lo, off_t hi, time_t when)
+{
+    while (hi - lo > PROBE_SIZE) {
+        const off_t mid = lo + (hi - lo) / 2;
+        time_t probe_time;
+        off_t probe_off;
+
+        switch (probe_entry(s, fd, buf, mid, &probe_off, &probe_time)) {
+        case -1:
+            return -1;
+        case 1:
+            if (probe_time < when && probe_off < hi) {
+                lo = probe_off;
+                break;
+            }
+            // FALLTHROUGH
+        default:
+            hi = mid;
+            break;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Find the first log message with a timestamp that starts at or after the given offset and
+ * within PROBE_SIZE bytes of it. Returns 1 if found, 0 if not, or -1 on error.
+ */
+static int
+probe_entry(struct logwarn_scanner *s, int fd, char *buf, off_t off, off_t *offp, time_t *whenp)
+{
+    const off_t from = off > 0 ? off - 1 : 0;
+    char *end;
+    char *nl;
+    char *p;
+    ssize_t r;
+
+    // Read the data, including the preceding byte so we can tell whether a line starts at `off'
+    while ((r = pread(fd, buf, PROBE_SIZE, from)) == -1) {
+        if (errno != EINTR) {
+            snprintf(s->error, sizeof(s->error), "%s: %s", "pread", strerror(errno));
+            return -1;
+        }
+    }
+    end = buf + r;
+
+    // Resynchronize to the start of the next line
+    p = buf;
+    if (off > 0) {
+        if ((nl = memchr(buf, '\n', r)) == NULL)
+            return 0;
+        p = nl + 1;
+    }
+
+    // Look for the first complete line that starts a log message and has a timestamp
+    for (; p < end && (nl = memchr(p, '\n', end - p)) != NULL; p = nl + 1) {
+        *nl = '\0';
+        if (s->options.multiline_pattern != NULL && regexec(&s->log_pattern.regex, p, 0, NULL, 0) != 0)
+            continue;
+        if (entry_time(s, p, whenp) == 0) {
+            *offp = from + (p - buf);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Get the timestamp of a log message. Consecutive messages often have the same timestamp,
+ * so we avoid parsing it again when the text (and the character after it) is the same as
+ * last time. Returns -1 if there is no timestamp.
+ */
+static int
+entry_time(struct logwarn_scanner *s, const char *line, time_t *whenp)
+{
+    const char *end;
+
+    if (s->stamp_len > 0 && strncmp(line, s->stamp, s->stamp_len) == 0) {
+        *whenp = s->stamp_time;
+        return 0;
+    }
+    if ((end = parse_time(s->options.time_format, line, s->now, whenp)) == NULL)
+        return -1;
+    s->stamp_len = end - line < MAX_STAMP_LENGTH ? end - line + 1 : 0;     // include what follows
+    memcpy(s->stamp, line, s->stamp_len);
+    s->stamp_time = *whenp;
+    return 0;
+}
+
+/*
+ * Parse the timestamp at the start of a log message using the given strptime(3) format.
+ * If the format has no year, the most recent year that does not put the timestamp more
+ * than one day after `now' is assumed. Returns -1 if the string does not match.
+ */
+int
+logwarn_parse_time(const char *format, const char *string, time_t now, time_t *tp)
+{
+    return parse_time(format, string, now, tp) != NULL ? 0 : -1;
+}
+
+/*
+ * Parse a timestamp; returns a pointer to the first character not parsed, or NULL if no match.
+ */
+static const char *
+parse_time(const char *format, const char *string, time_t now, time_t *tp)
+{
+    const char *end;
+    struct tm copy;
+    struct tm tm;
+    time_t t;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = NO_YEAR;
+    if ((end = strptime(string, format, &tm)) == NULL)
+        return NULL;
+    tm.tm_isdst = -1;
+    if (tm.tm_year == NO_YEAR) {
+        struct tm local;
+
+        localtime_r(&now, &local);
+        tm.tm_year = local.tm_year;
+        copy = tm;
+        if ((t = mktime(&copy)) != (time_t)-1 && t > now + 24 * 60 * 60)
+            tm.tm_year--;
+    }
+    if ((t = mktime(&tm)) == (time_t)-1)
+        return NULL;
+    *tp = t;
+    return end;
+}
+
+/*
+ * Find the first pattern that matches the line. Returns its index, or -1 if none.
+ */
+static int
+first_match(const struct logwarn_patterns *patterns, const char *line)
+{
+    int i;
+
+    for (i = 0; i < patterns->num_patterns; i++) {
+        if (regexec(&patterns->patterns[i].regex, line, 0, NULL, 0) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Find the first pattern that matches the line, evaluating patterns in the order chosen by order_patterns().
+ * Every SAMPLE_INTERVAL'th evaluation of each pattern is timed. Returns its index, or -1 if none.
+ */
+static int
+ordered_first_match(struct scan_set *set, const char *line)
+{
+    const struct logwarn_patterns *const patterns = set->patterns;
+    struct pattern_stats *const pstats = set->state->stats.patterns;
+    unsigned int k;
+
+    // Periodically update the order
+    if (++set->since_reorder >= REORDER_INTERVAL)
+        sort_patterns(set);
+
+    // Evaluate patterns
+    for (k = 0; k < set->num_order; k++) {
+        const unsigned int i = set->order[k];
+        struct pattern_stats *const ps = &pstats[i];
+        int result;
+
+        if ((ps->attempts++ & (SAMPLE_INTERVAL - 1)) == 0) {
+            struct timespec start;
+            struct timespec end;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            result = regexec(&patterns->patterns[i].regex, line, 0, NULL, 0);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ps->nsecs += ((end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec + 1) * SAMPLE_INTERVAL;
+        } else
+            result = regexec(&patterns->patterns[i].regex, line, 0, NULL, 0);
+        if (result == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Find the first pattern that matches the line, in declared or adaptive order. Returns its index, or -1 if none.
+ */
+static int
+evaluate_patterns(struct scan_set *set, const char *line)
+{
+    return set->order != NULL ? ordered_first_match(set, line) : first_match(set->patterns, line);
+}
+
+/*
+ * Find the first pattern that matches the line, using the rule set's match verdict cache.
+ * The cached line is compared in full, so hash collisions never produce a wrong verdict.
+ * If a prefix is skipped, lines differing only in that prefix are assumed to have the same verdict.
+ */
+static int
+cached_first_match(struct logwarn_scanner *s, struct scan_set *set, const char *line)
+{
+    struct scan_stats *const stats = &set->state->stats;
+    unsigned int hash = 2166136261U;
+    const char *key = line;
+    struct verdict *slot;
+    unsigned int skip;
+    const char *p;
+    size_t len;
+    int index;
+
+    // Hash the line using FNV-1a, ignoring the prefix
+    for (skip = s->options.cache_skip; skip > 0 && *key != '\0'; skip--)
+        key++;
+    for (p = key; *p != '\0'; p++)
+        hash = (hash ^ (unsigned char)*p) * 16777619U;
+    len = p - key;
+
+    // Check the cache
+    slot = &set->cache[hash & set->cache_mask];
+    if (slot->line != NULL && slot->hash == hash && slot->len == len && memcmp(slot->line, key, len) == 0) {
+        stats->cache_hits++;
+        return slot->index;
+    }
+    stats->cache_misses++;
+
+    // Evaluate the patterns and remember the result, replacing whatever was there
+    index = evaluate_patterns(set, line);
+    if (len > MAX_VERDICT_LENGTH)
+        return index;
+    if (slot->size < len) {
+        char *const buf = realloc(slot->line, len);
+
+        if (buf == NULL)
+            return index;
+        slot->line = buf;
+        slot->size = len;
+    }
+    if (slot->line == NULL && (slot->line = malloc(1)) == NULL)     // empty line
+        return index;
+    memcpy(slot->line, key, len);
+    slot->hash = hash;
+    slot->len = len;
+    slot->index = index;
+    return index;
+}
+
+/*
+ * Decide whether a log message matches, given its text, and update the rule set's counters accordingly.
+ * Returns 1 if so, 0 if not, or -1 on error.
+ */
+static int
+match_message(struct logwarn_scanner *s, struct scan_set *set, const char *text)
+{
+    struct logwarn_patterns *const patterns = set->patterns;
+    struct logwarn_state *const state = set->state;
+    int matches;
+    int i;
+
+    // Compile patterns on first use
+    if (!patterns->compiled && logwarn_patterns_compile(patterns) == -1) {
+        snprintf(s->error, sizeof(s->error), "%s", patterns->error);
+        return -1;
+    }
+
+    // Find the first matching pattern, if any
+    i = set->cache != NULL ? cached_first_match(s, set, text) : evaluate_patterns(set, text);
+
+    // Determine if this log message matches
+    if (i == -1)
+        matches = patterns->default_match;
+    else {
+        const struct repat *const pat = &patterns->patterns[i];
+
+        matches = pat->negate ? 0 : 1;
+
+        // Check for repeat suppression
+        if ((s->features & SCAN_REPEAT) != 0 && pat->repeat != -1) {
+            struct repeat *const repeat = &state->repeats[pat->repeat];
+            time_t now;
+            int count;
+
+            // Update timestamps by adding the current timestamp to the front of the array
+            time(&now);
+            memmove(repeat->occurrences + 1, repeat->occurrences, (repeat->num - 1) * sizeof(*repeat->occurrences));
+            repeat->occurrences[0] = (unsigned long)now;
+
+            // Check whether the repeat threshold has been exceeded
+            for (count = 0; count < repeat->num && repeat->occurrences[count] != 0; count++) {
+                const unsigned int age = repeat->occurrences[0] - repeat->occurrences[count];
+
+                if (age > repeat->secs)
+                    break;
+            }
+
+            // If not, treat like a non-matching line; if so, reset occurrence history for this pattern group
+            if (count < repeat->num) {
+                state->stats.suppressed++;
+                state->stats.patterns[i].suppressed++;
+                matches = 0;
+            } else
+                memset(repeat->occurrences, 0, repeat->num * sizeof(*repeat->occurrences));
+        }
+
+        // Count the pattern's decision, unless it was suppressed
+        if (matches || pat->negate)
+            state->stats.patterns[i].matches++;
+    }
+
+    // Update error count
+    if (matches) {
+        set->error_count++;
+        state->stats.matches++;
+    }
+    return matches;
+}
+
+/*
+ * Evaluate one line against one rule set. Returns -1 on error.
+ */
+static int
+scan_line(struct logwarn_scanner *s, struct scan_set *set, struct reader *r,
+    const char *line, size_t len, unsigned char continuation)
+{
+    struct logwarn_state *const state = set->state;
+
+    // Bump position and number of lines read
+    state->pos += len;
+    state->line++;
+    state->stats.lines++;
+    state->stats.bytes += len;
+
+    // Does this line match? New log entries lines only.
+    if (!continuation) {
+        int matches;
+
+        state->stats.messages++;
+
+        // When streaming with no idle delay, flush the previous log message's output now that it's complete
+        if (set->unflushed && r->idle_msecs == 0)
+            flush_output(set);
+
+        // Decide
+        if ((matches = match_message(s, set, line)) == -1)
+            return -1;
+
+        // Update matching state
+        state->matching = matches;
+    }
+
+    // Reset line counter
+    if (!continuation)
+        set->line_count = 0;
+
+    // Output line if it matches
+    if (state->matching) {
+
+        // Update flag
+        set->any_matches = 1;
+
+        // Output line if appropriate, preceded by any before context
+        if (set->options.output != NULL && s->options.max_lines_output > 0
+          && set->error_count <= set->options.max_errors_output) {
+            if ((s->features & SCAN_CONTEXT) != 0)
+                flush_before_context(s, set, r);
+            if (set->line_count < s->options.max_lines_output)
+                output_line(s, set, continuation ? LOGWARN_LINE_CONTINUATION : LOGWARN_LINE_MATCH, state->line - 1, line);
+            else
+                set->context_gap = 1;
+            if ((s->features & SCAN_CONTEXT) != 0)
+                state->after = s->options.after_context;
+        } else if ((s->features & SCAN_CONTEXT) != 0) {
+            discard_before_context(s, set, r);
+            set->context_gap = 1;
+            state->after = 0;
+        }
+
+        // Update line and error counters
+        set->line_count++;
+    } else if ((s->features & SCAN_CONTEXT) != 0) {
+        if (state->after > 0) {
+            output_line(s, set, LOGWARN_LINE_CONTEXT, state->line - 1, line);
+            state->after--;
+        } else if (s->options.before_context > 0)
+            push_before_context(s, set, r, line, state->line - 1);
+        else
+            set->context_gap = 1;
+    }
+    return 0;
+}
+
+/*
+ * Pass over a line that precedes the time range.
+ */
+static void
+skip_line(struct scan_set *set, size_t len, unsigned char continuation)
+{
+    struct logwarn_state *const state = set->state;
+
+    state->pos += len;
+    state->line++;
+    state->matching = 0;
+    state->after = 0;
+    state->stats.lines++;
+    state->stats.bytes += len;
+    if (!continuation)
+        state->stats.messages++;
+    set->context_gap = 1;
+}
+
+/*
+ * Add a line to the log message being assembled. Returns -1 on error.
+ */
+static int
+add_message_line(struct logwarn_scanner *s, struct reader *r, const char *line, size_t len,
+    unsigned long lnum, unsigned char continuation)
+{
+    struct message_line *mline;
+
+    // Start a new log message; it stays in the read buffer until finished
+    if (s->msg_offset == -1) {
+        s->msg_offset = logwarn_reader_offset(r, line);
+        s->msg_lnum = lnum;
+        s->msg_pos = r->consumed - (off_t)len;
+        s->msg_head = !continuation;
+        s->msg_num_lines = 0;
+        update_keep(s, r);
+    }
+
+    // Grow the line array if needed; it's reused for every log message
+    if (s->msg_num_lines == s->msg_max_lines) {
+        const unsigned int new_max = s->msg_max_lines > 0 ? 2 * s->msg_max_lines : 64;
+        struct message_line *const new_lines = realloc(s->msg_lines, new_max * sizeof(*s->msg_lines));
+
+        if (new_lines == NULL) {
+            snprintf(s->error, sizeof(s->error), "%s: %s", "realloc", strerror(errno));
+            return -1;
+        }
+        s->msg_lines = new_lines;
+        s->msg_max_lines = new_max;
+    }
+
+    // Add line
+    mline = &s->msg_lines[s->msg_num_lines++];
+    mline->offset = logwarn_reader_offset(r, line) - s->msg_offset;
+    mline->len = len;
+    s->msg_size = logwarn_reader_offset(r, r->buf + r->start) - s->msg_offset;
+    return 0;
+}
+
+/*
+ * Evaluate the log message being assembled, which is now complete, against each rule set.
+ * Does nothing if there is none. Returns -1 on error.
+ */
+static int
+finish_message(struct logwarn_scanner *s, struct reader *r)
+{
+    char *text;
+    unsigned int i;
+
+    if (s->msg_offset == -1)
+        return 0;
+    text = r->buf + (s->msg_offset - r->base);
+    for (i = 0; i < s->num_sets; i++) {
+        struct scan_set *const set = &s->sets[i];
+
+        if (set->active && !set->stopped && scan_message(s, set, r, text) == -1)
+            return -1;
+    }
+    s->msg_offset = -1;
+    s->msg_num_lines = 0;
+    update_keep(s, r);
+    return 0;
+}
+
+/*
+ * At the end of a log file that may still be written to, decide whether to leave the log message being
+ * assembled, if any, for the next invocation, in case more of its lines are on the way. A message is only
+ * held back once: if the file has not grown by the next invocation, the message is taken to be complete.
+ */
+static int
+hold_message(struct logwarn_scanner *s, struct reader *r)
+{
+    struct logwarn_state *const state = s->sets[0].state;
+
+    if (s->msg_offset == -1 || (state->held_pos == s->msg_pos && state->held_end == r->consumed)) {
+        state->held_pos = 0;
+        state->held_end = 0;
+        return 0;
+    }
+    state->held_pos = s->msg_pos;
+    state->held_end = r->consumed;
+    return 1;
+}
+
+/*
+ * Evaluate a whole log message against one rule set. Patterns are matched against the entire
+ * message, with its lines separated by newlines, and a matching message is output in one piece.
+ * Lines already seen by this rule set are skipped; if that includes the first line, the message
+ * is treated as continuation lines of the previous one. Returns -1 on error.
+ */
+static int
+scan_message(struct logwarn_scanner *s, struct scan_set *set, struct reader *r, char *text)
+{
+    struct logwarn_state *const state = set->state;
+    const unsigned int num_lines = s->msg_num_lines;
+    unsigned int first;
+    unsigned int count;
+    unsigned int i;
+
+    // Skip any lines this rule set has already seen
+    if (state->line >= s->msg_lnum + num_lines)
+        return 0;
+    first = state->line > s->msg_lnum ? state->line - s->msg_lnum : 0;
+
+    // Bump position and number of lines read, unless skipping messages outside the time range
+    for (i = first; i < num_lines; i++) {
+        const size_t len = s->msg_lines[i].len;
+
+        if ((s->features & SCAN_LIMITS) != 0 && s->skipping) {
+            skip_line(set, len, i > 0 || !s->msg_head);
+            continue;
+        }
+        state->pos += len;
+        state->line++;
+        state->stats.lines++;
+        state->stats.bytes += len;
+    }
+    if ((s->features & SCAN_LIMITS) != 0 && s->skipping)
+        return 0;
+
+    // Does this log message match?
+    if (first == 0 && s->msg_head) {
+        int matches;
+
+        state->stats.messages++;
+        set->line_count = 0;
+        join_lines(s, text, 0, num_lines, '\n');
+        matches = match_message(s, set, text);
+        join_lines(s, text, 0, num_lines, '\0');
+        if (matches == -1)
+            return -1;
+        state->matching = matches;
+    }
+
+    // Output the log message if it matches, preceded by any before context
+    if (state->matching) {
+
+        // Update flag
+        set->any_matches = 1;
+
+        // Output lines if appropriate, all at once
+        if (set->options.output != NULL && s->options.max_lines_output > 0
+          && set->error_count <= set->options.max_errors_output) {
+            if ((s->features & SCAN_CONTEXT) != 0)
+                flush_before_context(s, set, r);
+            count = set->line_count < s->options.max_lines_output ? s->options.max_lines_output - set->line_count : 0;
+            if (count > num_lines - first)
+                count = num_lines - first;
+            if (count > 0) {
+                join_lines(s, text, first, first + count, '\n');
+                output_line(s, set, first == 0 && s->msg_head ? LOGWARN_LINE_MATCH : LOGWARN_LINE_CONTINUATION,
+                  s->msg_lnum + first, text + s->msg_lines[first].offset);
+                join_lines(s, text, first, first + count, '\0');
+            }
+            if (count < num_lines - first)
+                set->context_gap = 1;
+            if ((s->features & SCAN_CONTEXT) != 0)
+                state->after = s->options.after_context;
+        } else if ((s->features & SCAN_CONTEXT) != 0) {
+            discard_before_context(s, set, r);
+            set->context_gap = 1;
+            state->after = 0;
+        }
+
+        // Update line counter
+        set->line_count += num_lines - first;
+    } else if ((s->features & SCAN_CONTEXT) != 0) {
+        for (i = first; i < num_lines; i++) {
+            const char *const line = text + s->msg_lines[i].offset;
+
+            if (state->after > 0) {
+                output_line(s, set, LOGWARN_LINE_CONTEXT, s->msg_lnum + i, line);
+                state->after--;
+            } else if (s->options.before_context > 0)
+                push_before_context(s, set, r, line, s->msg_lnum + i);
+            else
+                set->context_gap = 1;
+        }
+    }
+
+    // When streaming with no idle delay, flush now that the log message is complete
+    if (r->idle_msecs == 0)
+        flush_output(set);
+    return 0;
+}
+
+/*
+ * Set the separator following each of the given lines of the log message being assembled, except the last
+ * one of the message. A separator of '\n' joins the lines into a single string, and '\0' splits them again.
+ */
+static void
+join_lines(const struct logwarn_scanner *s, char *text, unsigned int from, unsigned int to, char sep)
+{
+    unsigned int i;
+
+    for (i = from; i + 1 < to; i++)
+        text[s->msg_lines[i + 1].offset - 1] = sep;
+}
+
+/*
+ * Read the next line, handling idle input in streaming mode.
+ * Returns NULL at end of file or on error; if the error occurred while idle, r->idle remains set.
+ */
+static char *
+next_line(struct logwarn_scanner *s, struct reader *r, size_t *lenp)
+{
+    char *line;
+
+    while ((line = logwarn_reader_getline(r, lenp)) == NULL && r->idle) {
+        if (input_idle(s, r) == -1)
+            return NULL;
+        r->idle = 0;
+    }
+    return line;
+}
+
+/*
+ * Scan lines from the reader, starting at line number lnum, and dispatch each line to every
+ * active rule set that has reached it. Returns -1 on error.
+ */
+static int
+scan_lines(struct logwarn_scanner *s, struct reader *r, unsigned long lnum)
+{
+    const struct logwarn_options *const options = &s->options;
+    unsigned long reads_checked = 0;
+    unsigned int i;
+    size_t len;
+    char *line;
+
+    for (; (line = next_line(s, r, &len)) != NULL; lnum++) {
+        unsigned char continuation;
+
+        // Check the clock once per block read
+        if ((s->features & SCAN_LIMITS) != 0 && options->max_seconds != 0 && r->reads != reads_checked) {
+            struct timespec now;
+
+            reads_checked = r->reads;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec - s->start_time.tv_sec) * 1000 + (now.tv_nsec - s->start_time.tv_nsec) / 1000000
+              >= (long)options->max_seconds * 1000)
+                s->out_of_time = 1;
+        }
+
+        // Is this a new log entry or a continuation line?
+        continuation = (s->features & SCAN_MULTILINE) != 0 && regexec(&s->log_pattern.regex, line, 0, NULL, 0) != 0;
+
+        // If assembling whole log messages, a new one completes the previous one
+        if ((s->features & SCAN_MULTILINE) != 0 && options->whole_messages && !continuation
+          && finish_message(s, r) == -1)
+            return -1;
+
+        // If this is not a continuation, check if we have reached our limit on the number of errors processed
+        if ((s->features & SCAN_LIMITS) != 0 && !continuation) {
+            for (i = 0; i < s->num_sets; i++) {
+                struct scan_set *const set = &s->sets[i];
+
+                if (set->active && !set->stopped && set->state->line <= lnum
+                  && set->error_count >= set->options.max_errors_processed) {
+                    set->stopped = 1;
+                    s->num_running--;
+                }
+            }
+            if (s->num_running == 0)
+                return 0;
+
+            // Likewise, check whether we have used up our time or byte budget
+            if (s->out_of_time || (options->max_bytes != 0 && s->bytes_scanned >= options->max_bytes)) {
+                s->budget_exhausted = 1;
+                return 0;
+            }
+
+            // Check the log message timestamp against the time range; lines without one don't change anything
+            if (s->skipping || (options->until != 0 && r->consumed - (off_t)len >= s->until_offset)) {
+                time_t when;
+
+                if (entry_time(s, line, &when) == 0) {
+                    if (when >= options->since)
+                        s->skipping = 0;
+                    if (options->until != 0 && when >= options->until) {
+                        for (i = 0; i < s->num_sets; i++)
+                            s->sets[i].stopped |= s->sets[i].active;
+                        s->num_running = 0;
+                        return 0;
+                    }
+                }
+            }
+        }
+        if ((s->features & SCAN_LIMITS) != 0)
+            s->bytes_scanned += len;
+
+        // If assembling whole log messages, add the line; if the log message is getting too big, settle for what we have
+        if ((s->features & SCAN_MULTILINE) != 0 && options->whole_messages) {
+            if (add_message_line(s, r, line, len, lnum, continuation) == -1)
+                return -1;
+            if ((s->msg_size >= MAX_MESSAGE_SIZE || s->msg_num_lines >= MAX_MESSAGE_LINES)
+              && finish_message(s, r) == -1)
+                return -1;
+            continue;
+        }
+
+        // Give the line to each rule set that has not already seen it
+        for (i = 0; i < s->num_sets; i++) {
+            struct scan_set *const set = &s->sets[i];
+
+            if (!set->active || set->stopped || set->state->line > lnum)
+                continue;
+            if ((s->features & SCAN_LIMITS) != 0 && s->skipping) {
+                skip_line(set, len, continuation);
+                continue;
+            }
+            if (scan_line(s, set, r, line, len, continuation) == -1)
+                return -1;
+        }
+    }
+
+    // An error occurred while input was idle, or the input has ended, completing any log message being assembled
+    if (r->idle)
+        return -1;
+    if ((s->features & SCAN_MULTILINE) != 0 && options->whole_messages && !(s->msg_hold && hold_message(s, r))
+      && finish_message(s, r) == -1)
+        return -1;
+    return 0;
+}
+
+static void
+output_line(struct logwarn_scanner *s, struct scan_set *set, int type, unsigned long lnum, const char *line)
+{
+    const struct logwarn_set_options *const options = &set->options;
+
+    if (set->context_gap && set->any_output && (s->options.before_context > 0 || s->options.after_context > 0))
+        (*options->output)(options->output_arg, LOGWARN_LINE_SEPARATOR, 0, NULL);
+    set->context_gap = 0;
+    set->any_output = 1;
+    set->unflushed = 1;
+    (*options->output)(options->output_arg, type, lnum, line);
+}
+
+/*
+ * Tell the output callback that now is a good time to flush any buffered output.
+ */
+static void
+flush_output(struct scan_set *set)
+{
+    const struct logwarn_set_options *const options = &set->options;
+
+    if (!set->unflushed)
+        return;
+    set->unflushed = 0;
+    (*options->output)(options->output_arg, LOGWARN_LINE_FLUSH, 0, NULL);
+}
+
+/*
+ * In streaming mode, the input has been idle for a while. Output from the last log message would
+ * otherwise sit in a buffer until more input arrives, so flush it now. If whole log messages are being
+ * assembled, assume the last one is complete. Returns -1 on error.
+ */
+static int
+input_idle(struct logwarn_scanner *s, struct reader *r)
+{
+    unsigned int i;
+
+    if (finish_message(s, r) == -1)
+        return -1;
+    for (i = 0; i < s->num_sets; i++)
+        flush_output(&s->sets[i]);
+    return 0;
+}
+
+/*
+ * Remember a non-matching line as potential before context. Lines are not copied;
+ * instead, the reader is told to retain them in its buffer.
+ */
+static void
+push_before_context(struct logwarn_scanner *s, struct scan_set *set, struct reader *r, const char *line, unsigned long lnum)
+{
+    const unsigned int before_context = s->options.before_context;
+    struct context_line *cline;
+
+    if (set->before_count == before_context) {
+        set->before_start = (set->before_start + 1) % before_context;
+        set->before_count--;
+        set->context_gap = 1;
+    }
+    cline = &set->before_lines[(set->before_start + set->before_count++) % before_context];
+    cline->offset = logwarn_reader_offset(r, line);
+    cline->line = lnum;
+    update_keep(s, r);
+}
+
+static void
+flush_before_context(struct logwarn_scanner *s, struct scan_set *set, struct reader *r)
+{
+    while (set->before_count > 0) {
+        const struct context_line *const cline = &set->before_lines[set->before_start];
+
+        output_line(s, set, LOGWARN_LINE_CONTEXT, cline->line, logwarn_reader_pointer(r, cline->offset));
+        set->before_start = (set->before_start + 1) % s->options.before_context;
+        set->before_count--;
+    }
+    update_keep(s, r);
+}
+
+static void
+discard_before_context(struct logwarn_scanner *s, struct scan_set *set, struct reader *r)
+{
+    if (set->before_count > 0)
+        set->context_gap = 1;
+    set->before_count = 0;
+    update_keep(s, r);
+}
+
+/*
+ * Tell the reader to retain the oldest leading context line of any rule set.
+ */
+static void
+update_keep(struct logwarn_scanner *s, struct reader *r)
+{
+    off_t keep = -1;
+    unsigned int i;
+
+    for (i = 0; i < s->num_sets; i++) {
+        const struct scan_set *const set = &s->sets[i];
+        off_t offset;
+
+        if (set->before_count == 0)
+            continue;
+        offset = set->before_lines[set->before_start].offset;
+        if (keep == -1 || offset < keep)
+            keep = offset;
+    }
+    if (s->msg_offset != -1 && (keep == -1 || s->msg_offset < keep))
+        keep = s->msg_offset;
+    logwarn_reader_keep(r, keep);
+}
@@ -25,6 +25,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,27 +38,241 @@
 #define LINENUM_NAME        "LINENUM"
 #define POSITION_NAME       "POSITION"
 #define MATCHING_NAME       "MATCHING"
+#define AFTER_NAME          "AFTER_CONTEXT"
+#define RULES_HASH_NAME     "RULES_HASH"
+#define HELD_POSITION_NAME  "HELD_POSITION"
+#define HELD_END_NAME       "HELD_END"
 #define REPEAT_PREFIX       "REPEAT_OCCURRENCES_"
 #define REPEAT_PREFIX_LEN   (sizeof(REPEAT_PREFIX) - 1)
+#define SET_PREFIX          "SET_"
+#define SET_PREFIX_LEN      (sizeof(SET_PREFIX) - 1)
+#define STATS_PATTERN_PREFIX        "STATS_PATTERN_"
+#define STATS_PATTERN_PREFIX_LEN    (sizeof(STATS_PATTERN_PREFIX) - 1)
 #define STDIN_LOGFILE_NAME  "_stdin"
 
+// Internal functions
+static int  init_state(struct logwarn_state *state, const struct logwarn_patterns *set);
+static void free_state(struct logwarn_state *state);
+static struct logwarn_state *find_set(struct logwarn_state *state, const char *name, size_t len);
+static void dump_values(FILE *fp, int is_stdin, const struct logwarn_state *state);
+static void clear_stats(struct scan_stats *stats);
+
+// Cumulative counters stored in the state file
+static const struct {
+    const char  *name;
+    size_t      offset;
+} stats_fields[] = {
+    { "STATS_MESSAGES",     offsetof(struct scan_stats, messages)     },
+    { "STATS_MATCHES",      offsetof(struct scan_stats, matches)      },
+    { "STATS_SUPPRESSED",   offsetof(struct scan_stats, suppressed)   },
+    { "STATS_LINES",        offsetof(struct scan_stats, lines)        },
+    { "STATS_BYTES",        offsetof(struct scan_stats, bytes)        },
+    { "STATS_ROTATIONS",    offsetof(struct scan_stats, rotations)    },
+    { "STATS_SCAN_MSECS",   offsetof(struct scan_stats, scan_msecs)   },
+    { "STATS_CACHE_HITS",   offsetof(struct scan_stats, cache_hits)   },
+    { "STATS_CACHE_MISSES", offsetof(struct scan_stats, cache_misses) },
+};
+#define NUM_STATS_FIELDS    (sizeof(stats_fields) / sizeof(*stats_fields))
+#define STATS_FIELD(stats, i)   (*(unsigned long long *)((char *)(stats) + stats_fields[i].offset))
+
+/*
+ * Create a scan state, with repeat state and per-pattern counters corresponding to the given pattern set, if any.
+ * Returns NULL (with errno set) on error.
+ */
+struct logwarn_state *
+logwarn_state_create(const struct logwarn_patterns *set)
+{
+    struct logwarn_state *state;
+
+    if ((state = malloc(sizeof(*state))) == NULL)
+        return NULL;
+    if (init_state(state, set) == -1) {
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+
+static int
+init_state(struct logwarn_state *state, const struct logwarn_patterns *set)
+{
+    unsigned int i;
+
+    memset(state, 0, sizeof(*state));
+    state->line = 1;
+    if (set == NULL)
+        return 0;
+    if (set->num_patterns > 0) {
+        if ((state->stats.patterns = malloc(set->num_patterns * sizeof(*state->stats.patterns))) == NULL)
+            return -1;
+        memset(state->stats.patterns, 0, set->num_patterns * sizeof(*state->stats.patterns));
+        for (i = 0; i < set->num_patterns; i++)
+            state->stats.patterns[i].hash = set->patterns[i].hash;
+        state->stats.num_patterns = set->num_patterns;
+    }
+    if (set->num_repeats == 0)
+        return 0;
+    if ((state->repeats = malloc(set->num_repeats * sizeof(*state->repeats))) == NULL) {
+        free_state(state);
+        return -1;
+    }
+    memset(state->repeats, 0, set->num_repeats * sizeof(*state->repeats));
+    for (i = 0; i < set->num_repeats; i++) {
+        struct repeat *const repeat = &state->repeats[i];
+
+        *repeat = set->repeats[i];
+        if ((repeat->occurrences = malloc(repeat->num * sizeof(*repeat->occurrences))) == NULL) {
+            state->num_repeats = i;
+            free_state(state);
+            return -1;
+        }
+        memset(repeat->occurrences, 0, repeat->num * sizeof(*repeat->occurrences));
+    }
+    state->num_repeats = set->num_repeats;
+    return 0;
+}
+
+/*
+ * Add state for an additional rule set, which must have a non-empty name consisting of
+ * letters and digits. Returns -1 (with errno set) on error.
+ */
+int
+logwarn_state_add_set(struct logwarn_state *state, const char *name, const struct logwarn_patterns *set)
+{
+    struct logwarn_state *sets;
+    struct logwarn_state *sub;
+    const char *s;
+
+    // Validate name
+    for (s = name; *s != '\0'; s++) {
+        if (!isalnum((unsigned char)*s))
+            break;
+    }
+    if (s == name || *s != '\0' || find_set(state, name, strlen(name)) != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Add state
+    if ((sets = realloc(state->sets, (state->num_sets + 1) * sizeof(*sets))) == NULL)
+        return -1;
+    state->sets = sets;
+    sub = &state->sets[state->num_sets];
+    if (init_state(sub, set) == -1)
+        return -1;
+    if ((sub->name = strdup(name)) == NULL) {
+        free_state(sub);
+        return -1;
+    }
+    state->num_sets++;
+    return 0;
+}
+
+/*
+ * Get the state of rule set N, where zero is the given state itself and additional rule sets start at one.
+ * Returns NULL if there is no such rule set.
+ */
+struct logwarn_state *
+logwarn_state_set(struct logwarn_state *state, unsigned int index)
+{
+    if (index == 0)
+        return state;
+    return index <= state->num_sets ? &state->sets[index - 1] : NULL;
+}
+
+/*
+ * Get the line number and file position where the next scan will start.
+ */
+void
+logwarn_state_position(const struct logwarn_state *state, unsigned long *linep, off_t *posp)
+{
+    *linep = state->line;
+    *posp = state->pos;
+}
+
+/*
+ * Get or set the hash of the rules that were last found to compile, as computed by the caller (e.g.,
+ * using logwarn_patterns_hash()). It is saved with the state, so that unchanged rules need not be checked again.
+ */
+unsigned int
+logwarn_state_rules_hash(const struct logwarn_state *state)
+{
+    return state->rules_hash;
+}
+
+void
+logwarn_state_set_rules_hash(struct logwarn_state *state, unsigned int hash)
+{
+    state->rules_hash = hash;
+}
+
+void
+logwarn_state_free(struct logwarn_state *state)
+{
+    if (state == NULL)
+        return;
+    free_state(state);
+    free(state);
+}
+
+static void
+free_state(struct logwarn_state *state)
+{
+    unsigned int i;
+
+    for (i = 0; i < state->num_repeats; i++)
+        free(state->repeats[i].occurrences);
+    free(state->repeats);
+    state->repeats = NULL;
+    state->num_repeats = 0;
+    for (i = 0; i < state->num_sets; i++)
+        free_state(&state->sets[i]);
+    free(state->sets);
+    state->sets = NULL;
+    state->num_sets = 0;
+    free(state->name);
+    state->name = NULL;
+    free(state->stats.patterns);
+    state->stats.patterns = NULL;
+    state->stats.num_patterns = 0;
+}
+
+static struct logwarn_state *
+find_set(struct logwarn_state *state, const char *name, size_t len)
+{
+    unsigned int i;
+
+    for (i = 0; i < state->num_sets; i++) {
+        struct logwarn_state *const sub = &state->sets[i];
+
+        if (strncmp(sub->name, name, len) == 0 && sub->name[len] == '\0')
+            return sub;
+    }
+    return NULL;
+}
+
+/*
+ * Load state from a state file.
+ * Returns -1 if the state file does not exist or can't be read.
+ */
 int
-load_state(const char *state_file, struct scan_state *state)
+logwarn_load_state(const char *state_file, struct logwarn_state *state)
 {
     char buf[1024];
     struct stat sb;
+    unsigned int j;
     int errno_save;
     FILE *fp;
     int fd;
 
-    reset_state(state);
-    state->line = 1;
-    if ((fp = fopen(state_file, "r")) == NULL)
+    logwarn_reset_state(state);
+    state->rules_hash = 0;
+    clear_stats(&state->stats);
+    for (j = 0; j < state->num_sets; j++)
+        clear_stats(&state->sets[j].stats);
+    if ((fp = fopen(state_file, "re")) == NULL)
         return -1;
-    if ((fd = fileno(fp)) == -1) {
-        fprintf(stderr, "%s: %s: %s\n", PACKAGE, state_file, strerror(errno));
-        exit(EXIT_ERROR);
-    }
+    fd = fileno(fp);
     if (fstat(fd, &sb) == -1 || S_ISDIR(sb.st_mode)) {
         errno_save = errno;
         fclose(fp);
@@ -65,8 +280,9 @@ load_state(const char *state_file, struct scan_state *state)
         return -1;
     }
     while (fgets(buf, sizeof(buf), fp) != NULL) {
+        struct logwarn_state *target = state;
         const char *s = buf;
-        unsigned long value;
+        unsigned long long value;
         const char *fname;
         char *fvalue;
         char *eptr;
@@ -90,6 +306,15 @@ load_state(const char *state_file, struct scan_state *state)
             continue;
         *t = '\0';
 
+        // Handle additional rule set values, which look like "SET_name_FIELD"
+        if (strncmp(fname, SET_PREFIX, SET_PREFIX_LEN) == 0) {
+            const char *const name = fname + SET_PREFIX_LEN;
+
+            if ((t = strchr(name, '_')) == NULL || (target = find_set(state, name, t - name)) == NULL)
+                continue;
+            fname = t + 1;
+        }
+
         // Handle repeat lines
         if (strncmp(fname, REPEAT_PREFIX, REPEAT_PREFIX_LEN) == 0) {
             struct repeat *repeat;
@@ -100,7 +325,7 @@ load_state(const char *state_file, struct scan_state *state)
 
             if (sscanf(fname + REPEAT_PREFIX_LEN, "%x", &hash) != 1)
                 continue;
-            if ((repeat = find_repeat(state, hash)) == NULL)
+            if ((repeat = logwarn_find_repeat(target, hash)) == NULL)
                 continue;
             for (token = strtok_r(fvalue, " ", &saveptr); token != NULL; token = strtok_r(NULL, " ", &saveptr)) {
                 unsigned long timestamp;
@@ -126,34 +351,76 @@ load_state(const char *state_file, struct scan_state *state)
             continue;
         }
 
+        // Handle per-pattern counter lines
+        if (strncmp(fname, STATS_PATTERN_PREFIX, STATS_PATTERN_PREFIX_LEN) == 0) {
+            unsigned long long matches;
+            unsigned long long suppressed;
+            unsigned long long attempts = 0;
+            unsigned long long nsecs = 0;
+            unsigned int hash;
+            int nfields;
+
+            // The evaluation counters are only present for patterns whose position is adaptive
+            if (sscanf(fname + STATS_PATTERN_PREFIX_LEN, "%x", &hash) != 1
+              || ((nfields = sscanf(fvalue, "%llu %llu %llu %llu", &matches, &suppressed, &attempts, &nsecs)) != 2
+                && nfields != 4))
+                continue;
+            for (j = 0; j < target->stats.num_patterns; j++) {
+                struct pattern_stats *const pstats = &target->stats.patterns[j];
+
+                if (pstats->hash == hash) {
+                    pstats->matches = matches;
+                    pstats->suppressed = suppressed;
+                    pstats->attempts = attempts;
+                    pstats->nsecs = nsecs;
+                    break;
+                }
+            }
+            continue;
+        }
+
         // Handle "false" and "true"
         if (strcmp(fvalue, "false") == 0)
             strcpy(fvalue, "0");
         else if (strcmp(fvalue, "true") == 0)
             strcpy(fvalue, "1");
 
-        // Decode numerical value
-        if (((value = strtoul(fvalue, &eptr, 10)) == ULONG_MAX && errno == ERANGE) || *eptr != '\0') {
-            fprintf(stderr, "%s: can't decode value \"%s\" for \"%s\"", PACKAGE, fvalue, fname);
+        // Decode numerical value; ignore undecodable values
+        if (((value = strtoull(fvalue, &eptr, 10)) == ULLONG_MAX && errno == ERANGE) || *eptr != '\0')
             continue;
-        }
 
         // Update state
         if (strcmp(fname, INODENUM_NAME) == 0)
-            state->inode = value;
+            target->inode = value;
         else if (strcmp(fname, LINENUM_NAME) == 0)
-            state->line = value;
+            target->line = value;
         else if (strcmp(fname, POSITION_NAME) == 0)
-            state->pos = value;
+            target->pos = value;
         else if (strcmp(fname, MATCHING_NAME) == 0)
-            state->matching = value != 0;
+            target->matching = value != 0;
+        else if (strcmp(fname, AFTER_NAME) == 0)
+            target->after = value;
+        else if (target == state && strcmp(fname, RULES_HASH_NAME) == 0)
+            state->rules_hash = (unsigned int)value;
+        else if (target == state && strcmp(fname, HELD_POSITION_NAME) == 0)
+            state->held_pos = value;
+        else if (target == state && strcmp(fname, HELD_END_NAME) == 0)
+            state->held_end = value;
+        else {
+            for (j = 0; j < NUM_STATS_FIELDS; j++) {
+                if (strcmp(fname, stats_fields[j].name) == 0) {
+                    STATS_FIELD(&target->stats, j) = value;
+                    break;
+                }
+            }
+        }
     }
     (void)fclose(fp);
     return 0;
 }
 
 struct repeat *
-find_repeat(struct scan_state *state, unsigned int hash) {
+logwarn_find_repeat(struct logwarn_state *state, unsigned int hash) {
     int i;
 
     for (i = 0; i < state->num_repeats; i++) {
@@ -165,53 +432,107 @@ find_repeat(struct scan_state *state, unsigned int hash) {
     return NULL;
 }
 
+static void
+clear_stats(struct scan_stats *stats)
+{
+    unsigned int i;
+
+    for (i = 0; i < NUM_STATS_FIELDS; i++)
+        STATS_FIELD(stats, i) = 0;
+    for (i = 0; i < stats->num_patterns; i++) {
+        stats->patterns[i].matches = 0;
+        stats->patterns[i].suppressed = 0;
+        stats->patterns[i].attempts = 0;
+        stats->patterns[i].nsecs = 0;
+    }
+}
+
+/*
+ * Reset state, including that of any additional rule sets, to the beginning of an unknown file.
+ * Cumulative counters are not affected.
+ */
 void
-reset_state(struct scan_state *state)
+logwarn_reset_state(struct logwarn_state *state)
 {
-    unsigned int num_repeats_save;
-    struct repeat *repeats_save;
+    unsigned int i;
 
-    // Reset state
-    num_repeats_save = state->num_repeats;
-    repeats_save = state->repeats;
-    memset(state, 0, sizeof(*state));
-    state->num_repeats = num_repeats_save;
-    state->repeats = repeats_save;
+    state->inode = 0;
+    state->line = 1;
+    state->pos = 0;
+    state->matching = 0;
+    state->after = 0;
+    state->held_pos = 0;
+    state->held_end = 0;
+    for (i = 0; i < state->num_sets; i++)
+        logwarn_reset_state(&state->sets[i]);
 }
 
+/*
+ * Rewind state, including that of any additional rule sets, to the beginning of the same file.
+ */
 void
-save_state(const char *state_file, const char *logfile, const struct scan_state *state)
+logwarn_rewind_state(struct logwarn_state *state)
+{
+    unsigned int i;
+
+    state->line = 1;
+    state->pos = 0;
+    for (i = 0; i < state->num_sets; i++)
+        logwarn_rewind_state(&state->sets[i]);
+}
+
+/*
+ * Save state to a state file.
+ * Returns -1 (with errno set) on error.
+ */
+int
+logwarn_save_state(const char *state_file, const char *logfile, const struct logwarn_state *state)
 {
     FILE *fp;
 
-    if ((fp = fopen(state_file, "w")) == NULL) {
-        fprintf(stderr, "%s: %s: %s\n", PACKAGE, state_file, strerror(errno));
-        exit(EXIT_ERROR);
-    }
-    dump_state(fp, logfile, state);
-    if (fclose(fp) == EOF) {
-        fprintf(stderr, "%s: %s: %s\n", PACKAGE, state_file, strerror(errno));
-        exit(EXIT_ERROR);
-    }
+    if ((fp = fopen(state_file, "we")) == NULL)
+        return -1;
+    logwarn_dump_state(fp, logfile, state);
+    if (fclose(fp) == EOF)
+        return -1;
+    return 0;
 }
 
 void
-dump_state(FILE *fp, const char *logfile, const struct scan_state *state)
+logwarn_dump_state(FILE *fp, const char *logfile, const struct logwarn_state *state)
 {
-    struct scan_state stdin_state;
     int i;
 
-    if (logfile == NULL) {
-        logfile = STDIN_LOGFILE_NAME;
-        stdin_state = *state;
-        stdin_state.inode = 0;
-        state = &stdin_state;
+    fprintf(fp, "# %s %s state for \"%s\"\n", PACKAGE_TARNAME, PACKAGE_VERSION,
+      logfile != NULL ? logfile : STDIN_LOGFILE_NAME);
+    dump_values(fp, logfile == NULL, state);
+    if (state->rules_hash != 0)
+        fprintf(fp, "%s=\"%u\"\n", RULES_HASH_NAME, state->rules_hash);
+    if (state->held_end != 0) {
+        fprintf(fp, "%s=\"%lu\"\n", HELD_POSITION_NAME, (unsigned long)state->held_pos);
+        fprintf(fp, "%s=\"%lu\"\n", HELD_END_NAME, (unsigned long)state->held_end);
     }
-    fprintf(fp, "# %s %s state for \"%s\"\n", PACKAGE_TARNAME, PACKAGE_VERSION, logfile);
-    fprintf(fp, "%s=\"%lu\"\n", INODENUM_NAME, (unsigned long)state->inode);
-    fprintf(fp, "%s=\"%lu\"\n", LINENUM_NAME, state->line);
-    fprintf(fp, "%s=\"%lu\"\n", POSITION_NAME, state->pos);
-    fprintf(fp, "%s=\"%s\"\n", MATCHING_NAME, state->matching ? "true" : "false");
+    for (i = 0; i < state->num_sets; i++)
+        dump_values(fp, logfile == NULL, &state->sets[i]);
+}
+
+/*
+ * Output the values for one rule set. Those of additional rule sets are prefixed with "SET_name_".
+ */
+static void
+dump_values(FILE *fp, int is_stdin, const struct logwarn_state *state)
+{
+    const char *const prefix = state->name != NULL ? SET_PREFIX : "";
+    const char *const name = state->name != NULL ? state->name : "";
+    const char *const sep = state->name != NULL ? "_" : "";
+    int i;
+
+    fprintf(fp, "%s%s%s%s=\"%lu\"\n", prefix, name, sep, INODENUM_NAME, is_stdin ? 0 : (unsigned long)state->inode);
+    fprintf(fp, "%s%s%s%s=\"%lu\"\n", prefix, name, sep, LINENUM_NAME, state->line);
+    fprintf(fp, "%s%s%s%s=\"%lu\"\n", prefix, name, sep, POSITION_NAME, state->pos);
+    fprintf(fp, "%s%s%s%s=\"%s\"\n", prefix, name, sep, MATCHING_NAME, state->matching ? "true" : "false");
+    if (state->after != 0)
+        fprintf(fp, "%s%s%s%s=\"%lu\"\n", prefix, name, sep, AFTER_NAME, state->after);
     for (i = 0; i < state->num_repeats; i++) {
         const struct repeat *repeat = &state->repeats[i];
         unsigned int rcount;
@@ -219,7 +540,7 @@ dump_state(FILE *fp, const char *logfile, const struct scan_state *state)
 
         if (repeat->occurrences[0] == 0)
             continue;
-        fprintf(fp, "%s%08x=\"", REPEAT_PREFIX, repeat->hash);
+        fprintf(fp, "%s%s%s%s%08x=\"", prefix, name, sep, REPEAT_PREFIX, repeat->hash);
         for (rnum = 0; rnum < repeat->num && repeat->occurrences[rnum] != 0; rnum += rcount) {
 
             // Output the next timestamp
@@ -236,36 +557,56 @@ dump_state(FILE *fp, const char *logfile, const struct scan_state *state)
         }
         fprintf(fp, "\"\n");
     }
+
+    // Cumulative counters; zero values are omitted
+    for (i = 0; i < NUM_STATS_FIELDS; i++) {
+        const unsigned long long value = *(const unsigned long long *)((const char *)&state->stats + stats_fields[i].offset);
+
+        if (value != 0)
+            fprintf(fp, "%s%s%s%s=\"%llu\"\n", prefix, name, sep, stats_fields[i].name, value);
+    }
+    for (i = 0; i < state->stats.num_patterns; i++) {
+        const struct pattern_stats *const pstats = &state->stats.patterns[i];
+
+        if (pstats->attempts != 0) {
+            fprintf(fp, "%s%s%s%s%08x=\"%llu %llu %llu %llu\"\n", prefix, name, sep, STATS_PATTERN_PREFIX,
+              pstats->hash, pstats->matches, pstats->suppressed, pstats->attempts, pstats->nsecs);
+        } else if (pstats->matches != 0 || pstats->suppressed != 0) {
+            fprintf(fp, "%s%s%s%s%08x=\"%llu %llu\"\n", prefix, name, sep,
+              STATS_PATTERN_PREFIX, pstats->hash, pstats->matches, pstats->suppressed);
+        }
+    }
 }
 
-void
-init_state_from_logfile(const char *logfile, struct scan_state *state)
+/*
+ * Initialize state as `up to date' with respect to the given log file.
+ * Returns -1 (with errno set) on error.
+ */
+int
+logwarn_init_state_from_logfile(const char *logfile, struct logwarn_state *state)
 {
     struct stat sb;
+    unsigned int i;
+    int errno_save;
     FILE *fp;
-    int fd;
     int ch;
 
     // Read state file
-    reset_state(state);
-    state->line = 1;
+    logwarn_reset_state(state);
     if (logfile == NULL)
-        return;
-    if ((fp = fopen(logfile, "r")) == NULL) {
-        fprintf(stderr, "%s: %s: %s\n", PACKAGE, logfile, strerror(errno));
-        exit(EXIT_ERROR);
-    }
-    if ((fd = fileno(fp)) == -1) {
-        fprintf(stderr, "%s: %s: %s\n", PACKAGE, logfile, strerror(errno));
-        exit(EXIT_ERROR);
-    }
-    if (fstat(fd, &sb) == -1) {
-        fprintf(stderr, "%s: %s: %s\n", PACKAGE, logfile, strerror(errno));
-        exit(EXIT_ERROR);
+        return 0;
+    if ((fp = fopen(logfile, "re")) == NULL)
+        return -1;
+    if (fstat(fileno(fp), &sb) == -1) {
+        errno_save = errno;
+        fclose(fp);
+        errno = errno_save;
+        return -1;
     }
     if (S_ISDIR(sb.st_mode)) {
-        fprintf(stderr, "%s: %s: %s\n", PACKAGE, logfile, strerror(EISDIR));
-        exit(EXIT_ERROR);
+        fclose(fp);
+        errno = EISDIR;
+        return -1;
     }
     state->inode = sb.st_ino;
     while ((ch = getc(fp)) != EOF) {
@@ -274,10 +615,28 @@ init_state_from_logfile(const char *logfile, struct scan_state *state)
             state->line++;
     }
     (void)fclose(fp);
+
+    // Additional rule sets are equally up to date
+    for (i = 0; i < state->num_sets; i++) {
+        state->sets[i].inode = state->inode;
+        state->sets[i].line = state->line;
+        state->sets[i].pos = state->pos;
+    }
+    return 0;
+}
+
+/*
+ * Determine whether the state (not including that of any additional rule sets) is up to date
+ * with respect to a log file with the given inode number and size, i.e., there is nothing new to scan.
+ */
+int
+logwarn_state_is_current(const struct logwarn_state *state, ino_t inode, off_t size)
+{
+    return state->inode == inode && state->pos == size;
 }
 
 void
-state_file_name(const char *state_dir, const char *logfile, char *buf, size_t max)
+logwarn_state_file_name(const char *state_dir, const char *logfile, char *buf, size_t max)
 {
     int i;
 
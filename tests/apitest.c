@@ -0,0 +1,120 @@
+/*
+ * Logwarn - Utility for finding interesting messages in log files
+ *
+ * Copyright (C) 2010-2011 Archie L. Cobbs. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Exercise the library API using only the public header: create and compile a pattern set, scan a log
+ * file twice with the same state, and print what the output callback received and where each scan stopped.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../liblogwarn.h"
+
+// Internal functions
+static logwarn_output_t output_line;
+static void scan(struct logwarn_scanner *scanner, const char *logfile, struct logwarn_state *state);
+static void fail(const char *what, const char *error);
+
+int
+main(int argc, char **argv)
+{
+    struct logwarn_patterns *patterns;
+    struct logwarn_patterns *bad;
+    struct logwarn_scanner *scanner;
+    struct logwarn_options options;
+    struct logwarn_state *state;
+    char ebuf[1024];
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: apitest logfile\n");
+        exit(2);
+    }
+
+    // An invalid pattern is reported when compiled
+    if ((bad = logwarn_patterns_create(1)) == NULL)
+        fail("logwarn_patterns_create", strerror(errno));
+    if (logwarn_patterns_add(bad, "(", 0) == -1)
+        fail("logwarn_patterns_add", logwarn_patterns_error(bad));
+    if (logwarn_patterns_compile(bad) != -1 || *logwarn_patterns_error(bad) == '\0')
+        fail("logwarn_patterns_compile", "invalid pattern was accepted");
+    logwarn_patterns_free(bad);
+
+    // Match errors, except harmless ones, case-insensitively
+    if ((patterns = logwarn_patterns_create(0)) == NULL)
+        fail("logwarn_patterns_create", strerror(errno));
+    if (logwarn_patterns_add(patterns, "!harmless", 0) == -1 || logwarn_patterns_add(patterns, "error", LOGWARN_ICASE) == -1)
+        fail("logwarn_patterns_add", logwarn_patterns_error(patterns));
+    if (logwarn_patterns_compile(patterns) == -1)
+        fail("logwarn_patterns_compile", logwarn_patterns_error(patterns));
+
+    // Create scanner for multi-line log messages
+    logwarn_options_init(&options);
+    options.multiline_pattern = "^START";
+    options.output = output_line;
+    options.output_arg = stdout;
+    if ((scanner = logwarn_scanner_create(patterns, &options, ebuf, sizeof(ebuf))) == NULL)
+        fail("logwarn_scanner_create", ebuf);
+    if ((state = logwarn_state_create(patterns)) == NULL)
+        fail("logwarn_state_create", strerror(errno));
+
+    // Scan twice; the second scan has nothing new
+    scan(scanner, argv[1], state);
+    scan(scanner, argv[1], state);
+
+    // Clean up
+    logwarn_state_free(state);
+    logwarn_scanner_free(scanner);
+    logwarn_patterns_free(patterns);
+    return 0;
+}
+
+static void
+output_line(void *arg, int type, unsigned long lnum, const char *line)
+{
+    fprintf(arg, "%d:%lu:%s\n", type, lnum, line != NULL ? line : "");
+}
+
+static void
+scan(struct logwarn_scanner *scanner, const char *logfile, struct logwarn_state *state)
+{
+    unsigned long line;
+    struct stat sb;
+    off_t pos;
+    int result;
+
+    if ((result = logwarn_scan(scanner, logfile, state)) == -1)
+        fail("logwarn_scan", logwarn_scanner_error(scanner));
+    if (stat(logfile, &sb) == -1)
+        fail(logfile, strerror(errno));
+    logwarn_state_position(state, &line, &pos);
+    printf("result=%d matched=%d line=%lu pos=%ld current=%d\n", result, logwarn_scanner_matched(scanner, 0),
+      line, (long)pos, logwarn_state_is_current(state, sb.st_ino, sb.st_size));
+}
+
+static void
+fail(const char *what, const char *error)
+{
+    fprintf(stderr, "apitest: %s: %s\n", what, error);
+    exit(1);
+}